@@ -162,7 +162,8 @@ void capture(safe::mail_t mail, config_t config, void *channel_data) {
     }
   }
 
-  auto samples = std::make_shared<sample_queue_t::element_type>(30);
+  // Late samples are worth less than recent ones
+  auto samples = std::make_shared<sample_queue_t::element_type>(30, safe::overflow_e::drop_oldest, "audio::samples");
   std::thread thread { encodeThread, samples, config, channel_data };
 
   auto fg = util::fail_guard([&]() {
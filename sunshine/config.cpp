@@ -168,6 +168,13 @@ video_t video {
   0, // hevc_mode
 
   1, // min_threads
+  0, // idle_fps
+  0,     // convert_threads
+  false, // shared_encode
+  2,     // warm_sessions
+  false, // prewarm
+  1,     // overload_control
+  0,     // core_pixel_rate
   {
     "superfast"s,   // preset
     "zerolatency"s, // tune
@@ -187,6 +194,8 @@ video_t video {
   {}, // encoder
   {}, // adapter_name
   {}, // output_name
+
+  "sunshine_tuning.json"s, // file_tuning
 };
 
 audio_t audio {};
@@ -643,6 +652,9 @@ int apply_flags(const char *line) {
     case '2':
       config::sunshine.flags[config::flag::FORCE_VIDEO_HEADER_REPLACE].flip();
       break;
+    case '3':
+      config::sunshine.flags[config::flag::REPROBE_ENCODERS].flip();
+      break;
     case 'p':
       config::sunshine.flags[config::flag::UPNP].flip();
       break;
@@ -668,6 +680,13 @@ void apply_config(std::unordered_map<std::string, std::string> &&vars) {
 
   int_f(vars, "qp", video.qp);
   int_f(vars, "min_threads", video.min_threads);
+  int_between_f(vars, "idle_fps", video.idle_fps, { 0, 120 });
+  int_f(vars, "convert_threads", video.convert_threads);
+  bool_f(vars, "shared_encode", video.shared_encode);
+  int_between_f(vars, "warm_sessions", video.warm_sessions, { 0, 16 });
+  bool_f(vars, "prewarm", video.prewarm);
+  int_between_f(vars, "overload_control", video.overload_control, { 0, 2 });
+  int_f(vars, "core_pixel_rate", video.core_pixel_rate);
   int_between_f(vars, "hevc_mode", video.hevc_mode, { 0, 3 });
   string_f(vars, "sw_preset", video.sw.preset);
   string_f(vars, "sw_tune", video.sw.tune);
@@ -688,6 +707,7 @@ void apply_config(std::unordered_map<std::string, std::string> &&vars) {
   string_f(vars, "encoder", video.encoder);
   string_f(vars, "adapter_name", video.adapter_name);
   string_f(vars, "output_name", video.output_name);
+  path_f(vars, "file_tuning", video.file_tuning);
 
   path_f(vars, "pkey", nvhttp.pkey);
   path_f(vars, "cert", nvhttp.cert);
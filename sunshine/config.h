@@ -16,6 +16,14 @@ struct video_t {
   int hevc_mode;
 
   int min_threads; // Minimum number of threads/slices for CPU encoding
+  int idle_fps;    // Frames per second sent while the captured image doesn't change
+
+  int convert_threads;  // Threads converting a captured image in main memory, 0 for automatic
+  bool shared_encode;   // Sessions with the same stream parameters share a single encoder
+  int warm_sessions;    // Encoder sessions of ended streams kept open for the next stream, 0 to disable
+  bool prewarm;         // Open encoder sessions for the advertised resolutions at startup
+  int overload_control; // 0: off, 1: faster presets and more slices, 2: also a lower resolution
+  int core_pixel_rate;  // Megapixels per second a core encodes in software, 0 to admit every session
   struct {
     std::string preset;
     std::string tune;
@@ -37,6 +45,8 @@ struct video_t {
   std::string encoder;
   std::string adapter_name;
   std::string output_name;
+
+  std::string file_tuning; // Software encoder settings measured with --tune
 };
 
 struct audio_t {
@@ -90,6 +100,7 @@ enum flag_e : std::size_t {
   FORCE_VIDEO_HEADER_REPLACE, // force replacing headers inside video data
   UPNP,                       // Try Universal Plug 'n Play
   CONST_PIN,                  // Use "universal" pin
+  REPROBE_ENCODERS,           // Probe the encoders even if the results of a previous probe are saved
   FLAG_SIZE
 };
 }
@@ -0,0 +1,184 @@
+#include <algorithm>
+
+#include "convert.h"
+#include "main.h"
+#include "video.h"
+
+using namespace std::literals;
+namespace convert {
+namespace scalar {
+static void store(std::uint8_t *row, int x, float value, const job_t &job) {
+  auto sample = (int)std::clamp(value, 0.0f, job.coefficients->max);
+
+  switch(job.pix_fmt) {
+  case platf::pix_fmt_e::yuv420p10:
+    ((std::uint16_t *)row)[x] = sample;
+    break;
+  case platf::pix_fmt_e::p010:
+    ((std::uint16_t *)row)[x] = sample << 6;
+    break;
+  default:
+    row[x] = sample;
+  }
+}
+
+void convert_rows(const job_t &job, int x_begin) {
+  auto &c = *job.coefficients;
+  auto f  = job.factor;
+
+  auto interleaved = job.pix_fmt == platf::pix_fmt_e::nv12 || job.pix_fmt == platf::pix_fmt_e::p010;
+
+  for(int y = job.y_begin; y < job.y_end; y += 2) {
+    auto row_u = job.dst[1] + y / 2 * job.dst_pitch[1];
+    auto row_v = interleaved ? nullptr : job.dst[2] + y / 2 * job.dst_pitch[2];
+
+    for(int x = x_begin; x < job.width; x += 2) {
+      float rgb_uv[3] {};
+
+      for(int dy = 0; dy < 2; ++dy) {
+        auto row_y = job.dst[0] + (y + dy) * job.dst_pitch[0];
+
+        for(int dx = 0; dx < 2; ++dx) {
+          float rgb[3] {};
+
+          for(int fy = 0; fy < f; ++fy) {
+            auto px = job.src + ((y + dy) * f + fy) * job.src_pitch + (x + dx) * f * 4;
+
+            for(int fx = 0; fx < f; ++fx, px += 4) {
+              rgb[0] += px[2];
+              rgb[1] += px[1];
+              rgb[2] += px[0];
+            }
+          }
+
+          store(row_y, x + dx, c.y[0] * rgb[0] + c.y[1] * rgb[1] + c.y[2] * rgb[2] + c.y_offset, job);
+
+          rgb_uv[0] += rgb[0];
+          rgb_uv[1] += rgb[1];
+          rgb_uv[2] += rgb[2];
+        }
+      }
+
+      auto u = c.u[0] * rgb_uv[0] + c.u[1] * rgb_uv[1] + c.u[2] * rgb_uv[2] + c.uv_offset;
+      auto v = c.v[0] * rgb_uv[0] + c.v[1] * rgb_uv[1] + c.v[2] * rgb_uv[2] + c.uv_offset;
+
+      if(interleaved) {
+        store(row_u, x, u, job);
+        store(row_u, x + 1, v, job);
+      }
+      else {
+        store(row_u, x / 2, u, job);
+        store(row_v, x / 2, v, job);
+      }
+    }
+  }
+}
+} // namespace scalar
+
+using convert_rows_fn = int (*)(const job_t &job);
+
+static convert_rows_fn select_kernel() {
+#ifdef SUNSHINE_CONVERT_X86
+  __builtin_cpu_init();
+
+  if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    BOOST_LOG(info) << "Color conversion: AVX2"sv;
+    return avx2::convert_rows;
+  }
+
+  if(__builtin_cpu_supports("sse4.1")) {
+    BOOST_LOG(info) << "Color conversion: SSE4.1"sv;
+    return sse4::convert_rows;
+  }
+#endif
+
+  BOOST_LOG(info) << "Color conversion: no SIMD"sv;
+  return [](const job_t &) { return 0; };
+}
+
+int converter_t::init(platf::pix_fmt_e pix_fmt, int in_width, int in_height, int out_width, int out_height) {
+  _pix_fmt = platf::pix_fmt_e::unknown;
+
+  if(pix_fmt == platf::pix_fmt_e::unknown || out_width % 2 || out_height % 2) {
+    return -1;
+  }
+
+  if(in_width == out_width && in_height == out_height) {
+    _factor = 1;
+  }
+  else if(in_width == out_width * 2 && in_height == out_height * 2) {
+    _factor = 2;
+  }
+  else {
+    return -1;
+  }
+
+  _pix_fmt = pix_fmt;
+  _width   = out_width;
+  _height  = out_height;
+
+  return 0;
+}
+
+void converter_t::set_colorspace(const video::color_t &color) {
+  auto kr = color.color_vec_y[0];
+  auto kb = color.color_vec_y[2];
+  auto kg = 1.0f - kr - kb;
+
+  // 8 bit values of the range
+  auto y_scale  = color.range_y[0] * 256.0f;
+  auto y_shift  = color.range_y[1] * 256.0f;
+  auto uv_scale = color.range_uv[0] * 256.0f;
+
+  auto bits  = 8;
+  auto depth = 1.0f;
+  if(_pix_fmt == platf::pix_fmt_e::yuv420p10 || _pix_fmt == platf::pix_fmt_e::p010) {
+    // Limited range 10 bit values are the 8 bit values shifted, full range spans all of them
+    bits  = 10;
+    depth = y_shift > 0.0f ? 4.0f : 1023.0f / 255.0f;
+  }
+
+  // The chroma is centered on the midpoint of the samples, in either range
+  auto uv_mid = (float)(1 << (bits - 1));
+
+  // Luma samples cover factor^2 pixels, chroma samples four times as many
+  auto pixels_y  = (float)(_factor * _factor);
+  auto pixels_uv = pixels_y * 4.0f;
+
+  auto y  = y_scale / 255.0f * depth / pixels_y;
+  auto cb = uv_scale / 255.0f * depth / pixels_uv / (2.0f * (1.0f - kb));
+  auto cr = uv_scale / 255.0f * depth / pixels_uv / (2.0f * (1.0f - kr));
+
+  // +0.5 to round, the kernels truncate
+  _coefficients = {
+    { kr * y, kg * y, kb * y },
+    y_shift * depth + 0.5f,
+    { -kr * cb, -kg * cb, (1.0f - kb) * cb },
+    { (1.0f - kr) * cr, -kg * cr, -kb * cr },
+    uv_mid + 0.5f,
+    (float)((1 << bits) - 1),
+  };
+}
+
+void converter_t::convert(const std::uint8_t *src, int src_pitch, std::uint8_t *const *dst, const int *dst_pitch, int y_begin, int y_end) const {
+  static auto convert_rows = select_kernel();
+
+  job_t job {
+    src,
+    src_pitch,
+    { dst[0], dst[1], dst[2] },
+    { dst_pitch[0], dst_pitch[1], dst_pitch[2] },
+    _width,
+    y_begin,
+    std::min(y_end, _height),
+    _factor,
+    _pix_fmt,
+    &_coefficients,
+  };
+
+  auto x = convert_rows(job);
+  if(x < job.width) {
+    scalar::convert_rows(job, x);
+  }
+}
+} // namespace convert
@@ -0,0 +1,110 @@
+#ifndef SUNSHINE_CONVERT_H
+#define SUNSHINE_CONVERT_H
+
+#include <cstdint>
+
+#include "platform/common.h"
+
+namespace video {
+struct color_t;
+}
+
+namespace convert {
+struct coefficients_t {
+  // Applied to the sum of the RGB values of the pixels covered by a luma sample
+  float y[3];
+  float y_offset;
+
+  // Applied to the sum of the RGB values of the pixels covered by a chroma sample
+  float u[3];
+  float v[3];
+  float uv_offset;
+
+  float max;
+};
+
+struct job_t {
+  // BGR0 source, covering the area being converted
+  const std::uint8_t *src;
+  int src_pitch;
+
+  // Planes of the destination, the chroma of NV12 and P010 is in dst[1]
+  std::uint8_t *dst[3];
+  int dst_pitch[3];
+
+  int width;
+
+  // Rows of the destination to convert, both even
+  int y_begin, y_end;
+
+  // Source pixels per destination pixel, along either axis
+  int factor;
+
+  platf::pix_fmt_e pix_fmt;
+
+  const coefficients_t *coefficients;
+};
+
+/**
+ * Converts BGR0 to YUV 4:2:0 without scaling or with a 2:1 box filter,
+ * using the SIMD kernels the CPU supports.
+ *
+ * Other ratios and odd sizes aren't supported, those are left to swscale.
+ */
+class converter_t {
+public:
+  /**
+   * @return -1 if the conversion isn't supported
+   */
+  int init(platf::pix_fmt_e pix_fmt, int in_width, int in_height, int out_width, int out_height);
+
+  void set_colorspace(const video::color_t &color);
+
+  /**
+   * Convert the destination rows [y_begin, y_end), y_begin must be even
+   *
+   * src --> The BGR0 image, scaled to the destination
+   * dst, dst_pitch --> The planes of the destination
+   */
+  void convert(const std::uint8_t *src, int src_pitch, std::uint8_t *const *dst, const int *dst_pitch, int y_begin, int y_end) const;
+
+  explicit operator bool() const {
+    return _pix_fmt != platf::pix_fmt_e::unknown;
+  }
+
+  int width() const {
+    return _width;
+  }
+
+  int height() const {
+    return _height;
+  }
+
+  int factor() const {
+    return _factor;
+  }
+
+private:
+  platf::pix_fmt_e _pix_fmt { platf::pix_fmt_e::unknown };
+
+  int _width, _height;
+  int _factor;
+
+  coefficients_t _coefficients;
+};
+
+// The SIMD kernels return the first column they didn't convert, the scalar kernel converts the remaining columns
+namespace scalar {
+void convert_rows(const job_t &job, int x_begin);
+}
+
+namespace sse4 {
+int convert_rows(const job_t &job);
+}
+
+namespace avx2 {
+int convert_rows(const job_t &job);
+}
+} // namespace convert
+
+#endif
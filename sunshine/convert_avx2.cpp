@@ -0,0 +1,53 @@
+// Compiled with -mavx2 -mfma
+#include "convert_kernel.h"
+
+namespace convert::avx2 {
+struct vector_t {
+  static constexpr int width = 8;
+
+  using vi = __m256i;
+  using vf = __m256;
+
+  static void load(const std::uint8_t *px, vi &r, vi &g, vi &b) {
+    auto bgr0 = _mm256_loadu_si256((const __m256i *)px);
+    auto mask = _mm256_set1_epi32(0xFF);
+
+    b = _mm256_and_si256(bgr0, mask);
+    g = _mm256_and_si256(_mm256_srli_epi32(bgr0, 8), mask);
+    r = _mm256_and_si256(_mm256_srli_epi32(bgr0, 16), mask);
+  }
+
+  static vi add(vi l, vi r) {
+    return _mm256_add_epi32(l, r);
+  }
+
+  static vi sum_pairs(vi lo, vi hi) {
+    // hadd works within 128 bit lanes: lo[0-3] hi[0-3] lo[4-7] hi[4-7]
+    return _mm256_permute4x64_epi64(_mm256_hadd_epi32(lo, hi), 0xD8);
+  }
+
+  static vf set1(float x) {
+    return _mm256_set1_ps(x);
+  }
+
+  static vf to_float(vi x) {
+    return _mm256_cvtepi32_ps(x);
+  }
+
+  static vf madd(vf a, vf b, vf c) {
+    return _mm256_fmadd_ps(a, b, c);
+  }
+
+  static vi to_int(vf x, vf max) {
+    return _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(x, _mm256_setzero_ps()), max));
+  }
+
+  static __m128i pack_u16(vi x) {
+    return _mm_packus_epi32(_mm256_castsi256_si128(x), _mm256_extracti128_si256(x, 1));
+  }
+};
+
+int convert_rows(const job_t &job) {
+  return convert::convert_rows<vector_t>(job);
+}
+} // namespace convert::avx2
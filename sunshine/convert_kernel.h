@@ -0,0 +1,163 @@
+/**
+ * The SIMD kernel shared by the instruction sets.
+ * Only included by the translation units compiled for a specific instruction set,
+ * V supplies the primitives operating on V::width pixels at once.
+ */
+#ifndef SUNSHINE_CONVERT_KERNEL_H
+#define SUNSHINE_CONVERT_KERNEL_H
+
+#include <algorithm>
+#include <cstring>
+
+#include <immintrin.h>
+
+#include "convert.h"
+
+namespace convert {
+template<class V>
+struct rgb_t {
+  typename V::vi r, g, b;
+};
+
+template<class V>
+rgb_t<V> load(const std::uint8_t *px) {
+  rgb_t<V> rgb;
+  V::load(px, rgb.r, rgb.g, rgb.b);
+
+  return rgb;
+}
+
+template<class V>
+rgb_t<V> add(const rgb_t<V> &l, const rgb_t<V> &r) {
+  return { V::add(l.r, r.r), V::add(l.g, r.g), V::add(l.b, r.b) };
+}
+
+/**
+ * Sum the adjacent pairs of 2 * V::width pixels
+ */
+template<class V>
+rgb_t<V> sum_pairs(const rgb_t<V> &lo, const rgb_t<V> &hi) {
+  return { V::sum_pairs(lo.r, hi.r), V::sum_pairs(lo.g, hi.g), V::sum_pairs(lo.b, hi.b) };
+}
+
+/**
+ * The sums of the source pixels covered by V::width destination pixels, starting at (x, y)
+ */
+template<class V>
+rgb_t<V> sum_pixels(const job_t &job, int x, int y) {
+  if(job.factor == 1) {
+    return load<V>(job.src + y * job.src_pitch + x * 4);
+  }
+
+  auto row_0 = job.src + y * 2 * job.src_pitch + x * 2 * 4;
+  auto row_1 = row_0 + job.src_pitch;
+
+  return sum_pairs<V>(
+    add<V>(load<V>(row_0), load<V>(row_1)),
+    add<V>(load<V>(row_0 + V::width * 4), load<V>(row_1 + V::width * 4)));
+}
+
+template<class V>
+typename V::vi transform(const rgb_t<V> &rgb, const float *m, float offset, float max) {
+  auto sample = V::madd(V::to_float(rgb.r), V::set1(m[0]),
+    V::madd(V::to_float(rgb.g), V::set1(m[1]),
+      V::madd(V::to_float(rgb.b), V::set1(m[2]), V::set1(offset))));
+
+  return V::to_int(sample, V::set1(max));
+}
+
+/**
+ * Store V::width samples, starting at sample x of row
+ */
+template<class V>
+void store(std::uint8_t *row, int x, typename V::vi samples, const job_t &job) {
+  auto words = V::pack_u16(samples);
+
+  switch(job.pix_fmt) {
+  case platf::pix_fmt_e::p010:
+    words = _mm_slli_epi16(words, 6);
+    [[fallthrough]];
+  case platf::pix_fmt_e::yuv420p10:
+    std::memcpy(row + x * 2, &words, V::width * 2);
+    break;
+  default: {
+    auto bytes = _mm_packus_epi16(words, words);
+    std::memcpy(row + x, &bytes, V::width);
+  }
+  }
+}
+
+/**
+ * Store V::width pairs of samples, starting at pair x of row
+ */
+template<class V>
+void store_interleaved(std::uint8_t *row, int x, typename V::vi u, typename V::vi v, const job_t &job) {
+  auto words_u = V::pack_u16(u);
+  auto words_v = V::pack_u16(v);
+
+  if(job.pix_fmt == platf::pix_fmt_e::p010) {
+    auto lo = _mm_slli_epi16(_mm_unpacklo_epi16(words_u, words_v), 6);
+    auto hi = _mm_slli_epi16(_mm_unpackhi_epi16(words_u, words_v), 6);
+
+    // The first register holds 4 pairs
+    std::memcpy(row + x * 4, &lo, std::min(V::width, 4) * 4);
+    if(V::width > 4) {
+      std::memcpy(row + x * 4 + 16, &hi, (V::width - 4) * 4);
+    }
+
+    return;
+  }
+
+  auto pairs = _mm_or_si128(words_u, _mm_slli_epi16(words_v, 8));
+  std::memcpy(row + x * 2, &pairs, V::width * 2);
+}
+
+/**
+ * @return the first column that hasn't been converted
+ */
+template<class V>
+int convert_rows(const job_t &job) {
+  constexpr int step = V::width * 2;
+
+  auto &c  = *job.coefficients;
+  auto end = job.width / step * step;
+
+  auto interleaved = job.pix_fmt == platf::pix_fmt_e::nv12 || job.pix_fmt == platf::pix_fmt_e::p010;
+
+  for(int y = job.y_begin; y < job.y_end; y += 2) {
+    auto row_y0 = job.dst[0] + y * job.dst_pitch[0];
+    auto row_y1 = row_y0 + job.dst_pitch[0];
+    auto row_u  = job.dst[1] + y / 2 * job.dst_pitch[1];
+    auto row_v  = interleaved ? nullptr : job.dst[2] + y / 2 * job.dst_pitch[2];
+
+    for(int x = 0; x < end; x += step) {
+      auto top_lo    = sum_pixels<V>(job, x, y);
+      auto top_hi    = sum_pixels<V>(job, x + V::width, y);
+      auto bottom_lo = sum_pixels<V>(job, x, y + 1);
+      auto bottom_hi = sum_pixels<V>(job, x + V::width, y + 1);
+
+      store<V>(row_y0, x, transform<V>(top_lo, c.y, c.y_offset, c.max), job);
+      store<V>(row_y0, x + V::width, transform<V>(top_hi, c.y, c.y_offset, c.max), job);
+      store<V>(row_y1, x, transform<V>(bottom_lo, c.y, c.y_offset, c.max), job);
+      store<V>(row_y1, x + V::width, transform<V>(bottom_hi, c.y, c.y_offset, c.max), job);
+
+      auto rgb_uv = sum_pairs<V>(add<V>(top_lo, bottom_lo), add<V>(top_hi, bottom_hi));
+
+      auto u = transform<V>(rgb_uv, c.u, c.uv_offset, c.max);
+      auto v = transform<V>(rgb_uv, c.v, c.uv_offset, c.max);
+
+      if(interleaved) {
+        store_interleaved<V>(row_u, x / 2, u, v, job);
+      }
+      else {
+        store<V>(row_u, x / 2, u, job);
+        store<V>(row_v, x / 2, v, job);
+      }
+    }
+  }
+
+  return end;
+}
+} // namespace convert
+
+#endif
@@ -0,0 +1,53 @@
+// Compiled with -msse4.1
+#include "convert_kernel.h"
+
+namespace convert::sse4 {
+struct vector_t {
+  static constexpr int width = 4;
+
+  using vi = __m128i;
+  using vf = __m128;
+
+  static void load(const std::uint8_t *px, vi &r, vi &g, vi &b) {
+    auto bgr0 = _mm_loadu_si128((const __m128i *)px);
+    auto mask = _mm_set1_epi32(0xFF);
+
+    b = _mm_and_si128(bgr0, mask);
+    g = _mm_and_si128(_mm_srli_epi32(bgr0, 8), mask);
+    r = _mm_and_si128(_mm_srli_epi32(bgr0, 16), mask);
+  }
+
+  static vi add(vi l, vi r) {
+    return _mm_add_epi32(l, r);
+  }
+
+  static vi sum_pairs(vi lo, vi hi) {
+    return _mm_hadd_epi32(lo, hi);
+  }
+
+  static vf set1(float x) {
+    return _mm_set1_ps(x);
+  }
+
+  static vf to_float(vi x) {
+    return _mm_cvtepi32_ps(x);
+  }
+
+  static vf madd(vf a, vf b, vf c) {
+    return _mm_add_ps(_mm_mul_ps(a, b), c);
+  }
+
+  static vi to_int(vf x, vf max) {
+    return _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(x, _mm_setzero_ps()), max));
+  }
+
+  // The samples end up in the lower half
+  static __m128i pack_u16(vi x) {
+    return _mm_packus_epi32(x, x);
+  }
+};
+
+int convert_rows(const job_t &job) {
+  return convert::convert_rows<vector_t>(job);
+}
+} // namespace convert::sse4
@@ -0,0 +1,244 @@
+#ifndef SUNSHINE_CPU_BUDGET_H
+#define SUNSHINE_CPU_BUDGET_H
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include "main.h"
+#include "video.h"
+
+namespace video {
+/**
+ * Splits the cores of the host between the sessions encoding in software.
+ *
+ * A session on its own, or as long as the cores suffice, gets the encoder threads it asks for.
+ * Otherwise the cores are split in proportion to the pixels per second each session encodes,
+ * and the sessions whose share changed remake their encoder.
+ */
+class cpu_budget_t {
+  struct entry_t {
+    config_t config;
+
+    // The encoder threads the session would use without a budget
+    int wanted;
+
+    std::atomic_int threads;
+  };
+
+public:
+  /**
+   * A session encoding in software, its share is returned to the budget when the lease is destroyed
+   */
+  class lease_t {
+  public:
+    lease_t(cpu_budget_t *budget, std::shared_ptr<entry_t> &&entry) : _budget { budget }, _entry { std::move(entry) } {}
+
+    lease_t(lease_t &&other) noexcept : _budget { other._budget }, _entry { std::move(other._entry) } {}
+
+    lease_t &operator=(lease_t &&other) noexcept {
+      std::swap(_budget, other._budget);
+      std::swap(_entry, other._entry);
+
+      return *this;
+    }
+
+    ~lease_t() {
+      if(_entry) {
+        _budget->release(_entry);
+      }
+    }
+
+    /**
+     * The encoder threads granted to the session
+     */
+    int threads() const {
+      return _entry->threads;
+    }
+
+    /**
+     * True if the session was granted fewer threads than it asked for
+     */
+    bool limited() const {
+      return _entry->threads < _entry->wanted;
+    }
+
+    /**
+     * The session changed its parameters
+     */
+    void update(const config_t &config, int wanted) {
+      _budget->update(_entry, config, wanted);
+    }
+
+  private:
+    cpu_budget_t *_budget;
+    std::shared_ptr<entry_t> _entry;
+  };
+
+  enum class admit_e {
+    accepted,
+    downgraded, // The framerate was halved
+    rejected
+  };
+
+  cpu_budget_t() : _cores { std::max(1, (int)std::thread::hardware_concurrency()) } {}
+
+  lease_t acquire(const config_t &config, int wanted) {
+    std::lock_guard lg { _lock };
+
+    return add(config, wanted);
+  }
+
+  /**
+   * Decide whether a new session fits next to the sessions encoding already.
+   * The first session is always accepted, the overload control adapts it to the host if need be.
+   *
+   * An admitted session counts against the budget right away, so sessions announced at the same time don't both fit.
+   * reserved holds its share until the session encodes with it, or is destroyed if the session doesn't start.
+   *
+   * core_pixel_rate --> The megapixels per second a core encodes, 0 to accept every session
+   * shared --> The session shares the encoder of a session with the same parameters if there is one
+   */
+  admit_e admit(config_t &config, int core_pixel_rate, bool shared, std::optional<lease_t> &reserved) {
+    using namespace std::literals;
+
+    if(core_pixel_rate <= 0) {
+      return admit_e::accepted;
+    }
+
+    std::lock_guard lg { _lock };
+
+    if(_entries.empty()) {
+      reserved = add(config, 1);
+
+      return admit_e::accepted;
+    }
+
+    double used {};
+    for(auto &entry : _entries) {
+      if(shared && equal(entry->config, config)) {
+        BOOST_LOG(info) << "Admitted session: it shares the encoder of a running session"sv;
+
+        reserved = add(config, 1);
+        return admit_e::accepted;
+      }
+
+      used += pixel_rate(entry->config);
+    }
+
+    auto capacity = (double)_cores * core_pixel_rate * 1000000;
+    auto wanted   = pixel_rate(config);
+
+    BOOST_LOG(info)
+      << "CPU budget: "sv << (int)(used / 1000000) << " of "sv << (int)(capacity / 1000000) << " megapixels per second in use by "sv
+      << _entries.size() << " sessions, "sv << config.width << 'x' << config.height << 'x' << config.framerate
+      << " asks for "sv << (int)(wanted / 1000000);
+
+    if(used + wanted <= capacity) {
+      BOOST_LOG(info) << "Admitted session"sv;
+
+      reserved = add(config, 1);
+      return admit_e::accepted;
+    }
+
+    if(config.framerate >= 2 && used + wanted / 2 <= capacity) {
+      config.framerate /= 2;
+
+      BOOST_LOG(warning) << "Admitted session at "sv << config.framerate << " fps to fit the CPU budget"sv;
+
+      reserved = add(config, 1);
+      return admit_e::downgraded;
+    }
+
+    BOOST_LOG(warning) << "Rejected session: it doesn't fit the CPU budget"sv;
+    return admit_e::rejected;
+  }
+
+private:
+  static double pixel_rate(const config_t &config) {
+    return (double)config.width * config.height * config.framerate;
+  }
+
+  static bool equal(const config_t &l, const config_t &r) {
+    return std::tie(l.width, l.height, l.framerate, l.bitrate, l.slicesPerFrame, l.numRefFrames, l.encoderCscMode, l.videoFormat, l.dynamicRange) ==
+           std::tie(r.width, r.height, r.framerate, r.bitrate, r.slicesPerFrame, r.numRefFrames, r.encoderCscMode, r.videoFormat, r.dynamicRange);
+  }
+
+  /**
+   * Requires _lock to be held
+   */
+  lease_t add(const config_t &config, int wanted) {
+    auto entry = std::make_shared<entry_t>();
+
+    entry->config  = config;
+    entry->wanted  = std::max(1, wanted);
+    entry->threads = entry->wanted;
+
+    _entries.emplace_back(entry);
+    rebalance();
+
+    return lease_t { this, std::move(entry) };
+  }
+
+  void update(const std::shared_ptr<entry_t> &entry, const config_t &config, int wanted) {
+    std::lock_guard lg { _lock };
+
+    entry->config = config;
+    entry->wanted = std::max(1, wanted);
+
+    rebalance();
+  }
+
+  void release(const std::shared_ptr<entry_t> &entry) {
+    std::lock_guard lg { _lock };
+
+    _entries.erase(std::find(std::begin(_entries), std::end(_entries), entry));
+    rebalance();
+  }
+
+  /**
+   * Recalculate the share of every session.
+   * Requires _lock to be held
+   */
+  void rebalance() {
+    using namespace std::literals;
+
+    int wanted {};
+    double total {};
+    for(auto &entry : _entries) {
+      wanted += entry->wanted;
+      total += pixel_rate(entry->config);
+    }
+
+    for(auto &entry : _entries) {
+      auto threads = entry->wanted;
+      if(wanted > _cores && _entries.size() > 1 && total > 0) {
+        auto share = (int)(_cores * pixel_rate(entry->config) / total);
+
+        threads = std::clamp(share, 1, entry->wanted);
+      }
+
+      if(entry->threads != threads) {
+        BOOST_LOG(info)
+          << "CPU budget: "sv << entry->config.width << 'x' << entry->config.height << 'x' << entry->config.framerate
+          << " session gets "sv << threads << " of "sv << entry->wanted << " encoder threads, "sv
+          << _entries.size() << " sessions share "sv << _cores << " cores"sv;
+
+        entry->threads = threads;
+      }
+    }
+  }
+
+  int _cores;
+
+  std::mutex _lock;
+  std::vector<std::shared_ptr<entry_t>> _entries;
+};
+} // namespace video
+
+#endif
@@ -0,0 +1,217 @@
+#ifndef SUNSHINE_IMG_POOL_H
+#define SUNSHINE_IMG_POOL_H
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "lock_stats.h"
+#include "main.h"
+#include "platform/common.h"
+
+namespace video {
+/**
+ * The images captured into, shared by the capture thread with the sessions.
+ *
+ * An image returns to the pool once the last reference to it is gone.
+ * While every image is referenced, the pool grows up to max_size, past that acquire() blocks until one returns,
+ * or until the capture stops.
+ * The images the sessions haven't needed for a while are released again.
+ */
+class img_pool_t {
+  struct state_t {
+    util::lock_stats::mutex_t lock;
+    util::lock_stats::condition_variable_t cv;
+
+    std::vector<std::shared_ptr<platf::img_t>> free;
+
+    // Images handed out by acquire() that haven't returned yet
+    int in_use {};
+
+    // Images of a previous display are dropped instead of returning to the pool
+    int generation {};
+  };
+
+public:
+  using alloc_f   = std::function<std::shared_ptr<platf::img_t>()>;
+  using running_f = std::function<bool()>;
+
+  /**
+   * max_size --> The most images allocated at once
+   * running --> Polled while acquire() waits for an image to return, it gives up once this returns false
+   */
+  img_pool_t(int max_size, running_f &&running) : _max_size { max_size }, _running { std::move(running) }, _state { std::make_shared<state_t>() } {
+    util::lock_stats::name(_state->lock, { "video::img_pool" });
+  }
+
+  /**
+   * Allocate the images of a new display with alloc
+   */
+  void reset(alloc_f &&alloc) {
+    using namespace std::literals;
+
+    clear();
+
+    _alloc = std::move(alloc);
+    _stats = { 0ns, 0, std::chrono::steady_clock::now() + 10s };
+  }
+
+  /**
+   * Release the images of the display.
+   * The images still in use are released as soon as nothing references them anymore.
+   */
+  void clear() {
+    std::vector<std::shared_ptr<platf::img_t>> free;
+    {
+      std::lock_guard lg { _state->lock };
+
+      free = std::move(_state->free);
+
+      _state->in_use = 0;
+      ++_state->generation;
+    }
+
+    _alloc = nullptr;
+    _size  = 0;
+    _peak  = 0;
+  }
+
+  /**
+   * Returns an image no one else references.
+   * nullptr if allocating a new image failed, or the capture stopped while waiting for an image
+   */
+  std::shared_ptr<platf::img_t> acquire() {
+    using namespace std::literals;
+
+    std::unique_lock ul { _state->lock };
+
+    if(_state->free.empty() && _size < _max_size) {
+      ul.unlock();
+      auto img = _alloc();
+      if(!img) {
+        BOOST_LOG(error) << "Couldn't initialize an image"sv;
+        return nullptr;
+      }
+      ul.lock();
+
+      ++_size;
+      _state->free.emplace_back(std::move(img));
+
+      BOOST_LOG(debug) << "Image pool grew to "sv << _size << " images"sv;
+    }
+
+    if(_state->free.empty()) {
+      auto begin = std::chrono::steady_clock::now();
+      auto fg    = util::fail_guard([&]() {
+        _stats.stall += std::chrono::steady_clock::now() - begin;
+        ++_stats.stalls;
+      });
+
+      // The sessions may hold on to every image while the capture is being torn down
+      while(!_state->cv.wait_for(ul, 100ms, [this]() { return !_state->free.empty(); })) {
+        if(!_running()) {
+          return nullptr;
+        }
+      }
+    }
+
+    auto img = std::move(_state->free.back());
+    _state->free.pop_back();
+
+    _peak = std::max(_peak, ++_state->in_use);
+
+    auto generation = _state->generation;
+    ul.unlock();
+
+    report();
+
+    auto img_p = img.get();
+    return std::shared_ptr<platf::img_t>(img_p, [state_wp = std::weak_ptr { _state }, img = std::move(img), generation](platf::img_t *) mutable {
+      auto state = state_wp.lock();
+      if(state) {
+        std::lock_guard lg { state->lock };
+
+        if(state->generation == generation) {
+          --state->in_use;
+          state->free.emplace_back(std::move(img));
+
+          state->cv.notify_one();
+          return;
+        }
+      }
+
+      img.reset();
+    });
+  }
+
+  /**
+   * Called when a session ended, releases the images beyond those in use right now
+   */
+  void trim() {
+    std::lock_guard lg { _state->lock };
+
+    _peak = _state->in_use;
+    shrink();
+  }
+
+private:
+  /**
+   * Every 10 seconds, log the occupancy of the pool and release the images that weren't needed meanwhile
+   */
+  void report() {
+    using namespace std::literals;
+
+    auto now = std::chrono::steady_clock::now();
+    if(now < _stats.next_report) {
+      return;
+    }
+
+    std::lock_guard lg { _state->lock };
+
+    BOOST_LOG(debug)
+      << "Image pool: "sv << _size << " images, at most "sv << _peak << " in use, "sv
+      << _stats.stalls << " stalls for "sv << std::chrono::duration<double, std::milli>(_stats.stall).count() << "ms"sv;
+
+    shrink();
+
+    _peak  = _state->in_use;
+    _stats = { 0ns, 0, now + 10s };
+  }
+
+  /**
+   * Release free images until the pool holds one more than the most in use at once.
+   * The spare is needed because the display acquires the next image before handing back the current one.
+   * Requires _state->lock to be held
+   */
+  void shrink() {
+    auto &free = _state->free;
+    while(_size > _peak + 1 && !free.empty()) {
+      free.pop_back();
+
+      --_size;
+    }
+  }
+
+  alloc_f _alloc;
+
+  int _max_size;
+
+  running_f _running;
+
+  // The number of images allocated for the current display, and the most in use at once since the last report
+  int _size {};
+  int _peak {};
+
+  struct {
+    std::chrono::nanoseconds stall;
+    int stalls;
+
+    std::chrono::steady_clock::time_point next_report;
+  } _stats {};
+
+  std::shared_ptr<state_t> _state;
+};
+} // namespace video
+
+#endif
@@ -0,0 +1,138 @@
+#ifndef SUNSHINE_INIT_PHASES_H
+#define SUNSHINE_INIT_PHASES_H
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <list>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "main.h"
+
+namespace util {
+/**
+ * Runs the phases of the startup, each one as soon as the phases it depends on have succeeded.
+ * Phases that don't depend on each other run at the same time.
+ *
+ * The calling thread runs the first phase, the others get a thread of their own.
+ * A phase can only depend on phases added before it.
+ */
+class init_phases_t {
+public:
+  // Returns 0 on success, otherwise the exit code of the process
+  using init_f = std::function<int()>;
+
+  init_phases_t() : _start { std::chrono::steady_clock::now() } {}
+
+  void add(std::string_view name, std::initializer_list<std::string_view> after, init_f &&init) {
+    using namespace std::literals;
+
+    auto &phase = _phases.emplace_back();
+
+    phase.name   = name;
+    phase.init   = std::move(init);
+    phase.result = phase.promise.get_future().share();
+
+    for(auto dependency : after) {
+      auto pos = std::find_if(std::begin(_phases), std::end(_phases), [dependency](const phase_t &phase) {
+        return phase.name == dependency;
+      });
+
+      if(pos == std::end(_phases) || &*pos == &phase) {
+        BOOST_LOG(error) << "Startup phase ["sv << name << "] depends on ["sv << dependency << "], which isn't added before it"sv;
+        continue;
+      }
+
+      phase.after.emplace_back(pos->result);
+    }
+  }
+
+  /**
+   * Run all phases, a phase whose dependency failed is skipped.
+   * Returns 0 if all phases succeeded, otherwise the result of the first phase added that didn't
+   */
+  int run() {
+    using namespace std::literals;
+
+    if(_phases.empty()) {
+      return 0;
+    }
+
+    std::vector<std::thread> threads;
+    for(auto pos = std::next(std::begin(_phases)); pos != std::end(_phases); ++pos) {
+      threads.emplace_back(&init_phases_t::run_phase, std::ref(*pos));
+    }
+
+    run_phase(_phases.front());
+
+    for(auto &thread : threads) {
+      thread.join();
+    }
+
+    int status = 0;
+    for(auto &phase : _phases) {
+      auto result = phase.result.get();
+
+      if(phase.begin == std::chrono::steady_clock::time_point {}) {
+        BOOST_LOG(info) << "Startup: "sv << phase.name << " skipped"sv;
+      }
+      else {
+        BOOST_LOG(info)
+          << "Startup: "sv << phase.name << " ["sv << milliseconds(phase.begin) << "ms - "sv << milliseconds(phase.end) << "ms]"sv
+          << (result ? " failed"sv : ""sv);
+      }
+
+      if(!status) {
+        status = result;
+      }
+    }
+
+    BOOST_LOG(info) << "Startup took "sv << milliseconds(std::chrono::steady_clock::now()) << "ms"sv;
+
+    return status;
+  }
+
+private:
+  struct phase_t {
+    std::string_view name;
+    init_f init;
+
+    std::vector<std::shared_future<int>> after;
+
+    std::promise<int> promise;
+    std::shared_future<int> result;
+
+    // Unset if the phase was skipped
+    std::chrono::steady_clock::time_point begin, end;
+  };
+
+  static void run_phase(phase_t &phase) {
+    for(auto &dependency : phase.after) {
+      if(auto result = dependency.get()) {
+        phase.promise.set_value(result);
+        return;
+      }
+    }
+
+    phase.begin = std::chrono::steady_clock::now();
+    auto result = phase.init();
+    phase.end = std::chrono::steady_clock::now();
+
+    phase.promise.set_value(result);
+  }
+
+  std::int64_t milliseconds(std::chrono::steady_clock::time_point tp) const {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(tp - _start).count();
+  }
+
+  std::chrono::steady_clock::time_point _start;
+
+  // A list, so a phase stays in place while more phases are added
+  std::list<phase_t> _phases;
+};
+} // namespace util
+
+#endif
@@ -74,7 +74,7 @@ struct gamepad_t {
   gamepad_t() : gamepad_state {}, back_timeout_id {}, id { -1 }, back_button_state { button_state_e::NONE } {}
   ~gamepad_t() {
     if(id >= 0) {
-      task_pool.push([id = this->id]() {
+      task_pool.post([id = this->id]() {
         free_gamepad(platf_input, id);
       });
     }
@@ -105,11 +105,13 @@ struct input_t {
 
   input_t(
     safe::mail_raw_t::event_t<input::touch_port_t> touch_port_event,
+    safe::mail_raw_t::event_t<int> switch_display_event,
     platf::rumble_queue_t rumble_queue)
       : shortcutFlags {},
         active_gamepad_state {},
         gamepads(MAX_GAMEPADS),
         touch_port_event { std::move(touch_port_event) },
+        switch_display_event { std::move(switch_display_event) },
         rumble_queue { std::move(rumble_queue) },
         mouse_left_button_timeout {},
         touch_port { 0, 0, 0, 0, 0, 0, 1.0f } {}
@@ -121,6 +123,10 @@ struct input_t {
   std::vector<gamepad_t> gamepads;
 
   safe::mail_raw_t::event_t<input::touch_port_t> touch_port_event;
+
+  // Switches the display captured for this session only
+  safe::mail_raw_t::event_t<int> switch_display_event;
+
   platf::rumble_queue_t rumble_queue;
 
   util::ThreadPool::task_id_t mouse_left_button_timeout;
@@ -135,13 +141,16 @@ struct input_t {
  * On nothing
  *    return 0
  */
-inline int apply_shortcut(short keyCode) {
+inline int apply_shortcut(input_t &input, short keyCode) {
   constexpr auto VK_F1  = 0x70;
   constexpr auto VK_F13 = 0x7C;
 
   BOOST_LOG(debug) << "Apply Shortcut: 0x"sv << util::hex((std::uint8_t)keyCode).to_string_view();
 
   if(keyCode >= VK_F1 && keyCode <= VK_F13) {
+    input.switch_display_event->raise(keyCode - VK_F1);
+
+    // Encoders that capture synchronously share a single display between all sessions
     mail::man->event<int>(mail::switch_display)->raise(keyCode - VK_F1);
     return 1;
   }
@@ -428,7 +437,7 @@ void passthrough(std::shared_ptr<input_t> &input, PNV_KEYBOARD_PACKET packet) {
     if(!release) {
       // A new key has been pressed down, we need to check for key combo's
       // If a keycombo has been pressed down, don't pass it through
-      if(input->shortcutFlags == input_t::SHORTCUT && apply_shortcut(keyCode) > 0) {
+      if(input->shortcutFlags == input_t::SHORTCUT && apply_shortcut(*input, keyCode) > 0) {
         return;
       }
 
@@ -632,7 +641,7 @@ void passthrough_helper(std::shared_ptr<input_t> input, std::vector<std::uint8_t
 }
 
 void passthrough(std::shared_ptr<input_t> &input, std::vector<std::uint8_t> &&input_data) {
-  task_pool.push(passthrough_helper, input, util::cmove(input_data));
+  task_pool.post(passthrough_helper, input, std::move(input_data));
 }
 
 void reset(std::shared_ptr<input_t> &input) {
@@ -640,7 +649,7 @@ void reset(std::shared_ptr<input_t> &input) {
   task_pool.cancel(input->mouse_left_button_timeout);
 
   // Ensure input is synchronous, by using the task_pool
-  task_pool.push([]() {
+  task_pool.post([]() {
     for(int x = 0; x < mouse_press.size(); ++x) {
       if(mouse_press[x]) {
         platf::button_mouse(platf_input, x, true);
@@ -671,6 +680,7 @@ public:
 std::shared_ptr<input_t> alloc(safe::mail_t mail) {
   auto input = std::make_shared<input_t>(
     mail->event<input::touch_port_t>(mail::touch_port),
+    mail->event<int>(mail::switch_display),
     mail->queue<platf::rumble_t>(mail::rumble));
 
   // Workaround to ensure new frames will be captured when a client connects
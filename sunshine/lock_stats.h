@@ -0,0 +1,273 @@
+#ifndef SUNSHINE_LOCK_STATS_H
+#define SUNSHINE_LOCK_STATS_H
+
+#include <condition_variable>
+#include <mutex>
+
+#ifdef SUNSHINE_LOCK_STATS
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+#endif
+
+namespace util {
+#ifdef SUNSHINE_LOCK_STATS
+/**
+ * Names the lock of a sync_t, safe::event_t or safe::queue_t
+ * Locks sharing a name are accounted together.
+ */
+struct lock_site_t {
+  constexpr lock_site_t() : name { "unnamed" } {}
+  constexpr lock_site_t(const char *name) : name { name } {}
+
+  const char *name;
+};
+
+namespace lock_stats {
+// Bucket 0 counts zero durations, bucket x counts durations in [2^(x-1), 2^x) nanoseconds
+constexpr std::size_t BUCKETS = 40;
+
+class histogram_t {
+public:
+  void record(std::chrono::nanoseconds duration) {
+    std::uint64_t ns = std::max<std::int64_t>(duration.count(), 0);
+
+    std::size_t bucket = 0;
+    while(bucket < BUCKETS - 1 && (ns >> bucket)) {
+      ++bucket;
+    }
+
+    _buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    _total.fetch_add(ns, std::memory_order_relaxed);
+
+    auto max = _max.load(std::memory_order_relaxed);
+    while(ns > max && !_max.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {}
+  }
+
+  std::uint64_t count() const {
+    std::uint64_t count = 0;
+    for(auto &bucket : _buckets) {
+      count += bucket.load(std::memory_order_relaxed);
+    }
+
+    return count;
+  }
+
+  /**
+   * @return the upper bound of the bucket containing quantile q
+   */
+  std::chrono::nanoseconds quantile(double q) const {
+    auto target = (std::uint64_t)(q * count());
+
+    std::uint64_t seen = 0;
+    for(std::size_t x = 0; x < BUCKETS; ++x) {
+      seen += _buckets[x].load(std::memory_order_relaxed);
+
+      if(seen > target) {
+        return std::chrono::nanoseconds { x ? 1ull << x : 0 };
+      }
+    }
+
+    return max();
+  }
+
+  std::chrono::nanoseconds total() const {
+    return std::chrono::nanoseconds { _total.load(std::memory_order_relaxed) };
+  }
+
+  std::chrono::nanoseconds max() const {
+    return std::chrono::nanoseconds { _max.load(std::memory_order_relaxed) };
+  }
+
+  void reset() {
+    for(auto &bucket : _buckets) {
+      bucket.store(0, std::memory_order_relaxed);
+    }
+
+    _total.store(0, std::memory_order_relaxed);
+    _max.store(0, std::memory_order_relaxed);
+  }
+
+private:
+  std::array<std::atomic<std::uint64_t>, BUCKETS> _buckets {};
+  std::atomic<std::uint64_t> _total {};
+  std::atomic<std::uint64_t> _max {};
+};
+
+struct site_t {
+  explicit site_t(std::string name) : name { std::move(name) } {}
+
+  std::string name;
+
+  // Time between requesting the lock and owning it
+  histogram_t wait;
+
+  // Time between owning the lock and releasing it
+  histogram_t hold;
+
+  std::atomic<std::uint64_t> contended {};
+};
+
+class registry_t {
+public:
+  site_t *site(const char *name) {
+    std::lock_guard lg { _lock };
+
+    auto &site = _sites[name];
+    if(!site) {
+      site = std::make_unique<site_t>(name);
+    }
+
+    return site.get();
+  }
+
+  /**
+   * Write one line per site, the sites with the most time spent waiting first
+   */
+  void dump(std::ostream &out) {
+    std::vector<site_t *> sites;
+    {
+      std::lock_guard lg { _lock };
+
+      for(auto &[_, site] : _sites) {
+        sites.emplace_back(site.get());
+      }
+    }
+
+    std::sort(std::begin(sites), std::end(sites), [](site_t *l, site_t *r) {
+      return l->wait.total() > r->wait.total();
+    });
+
+    auto us = [](std::chrono::nanoseconds ns) {
+      return std::chrono::duration<double, std::micro>(ns).count();
+    };
+
+    out << std::fixed << std::setprecision(1);
+    for(auto site : sites) {
+      auto count = site->hold.count();
+      if(!count) {
+        continue;
+      }
+
+      out << site->name << ": "
+          << count << " locks, " << site->contended.load(std::memory_order_relaxed) << " contended -- "
+          << "wait [total " << us(site->wait.total()) << "us, p50 " << us(site->wait.quantile(0.5)) << "us, p99 " << us(site->wait.quantile(0.99)) << "us, max " << us(site->wait.max()) << "us] "
+          << "hold [total " << us(site->hold.total()) << "us, p50 " << us(site->hold.quantile(0.5)) << "us, p99 " << us(site->hold.quantile(0.99)) << "us, max " << us(site->hold.max()) << "us]"
+          << std::endl;
+    }
+  }
+
+  void reset() {
+    std::lock_guard lg { _lock };
+
+    for(auto &[_, site] : _sites) {
+      site->wait.reset();
+      site->hold.reset();
+      site->contended.store(0, std::memory_order_relaxed);
+    }
+  }
+
+private:
+  std::mutex _lock;
+  std::map<std::string, std::unique_ptr<site_t>> _sites;
+};
+
+inline registry_t &registry() {
+  // Never destroyed, locks may still be taken by threads outliving main()
+  static auto registry = new registry_t;
+
+  return *registry;
+}
+
+inline void dump(std::ostream &out) {
+  registry().dump(out);
+}
+
+inline void reset() {
+  registry().reset();
+}
+
+/**
+ * A std::mutex that records wait and hold times to its site
+ */
+class mutex_t {
+public:
+  mutex_t() : _site { registry().site("unnamed") } {}
+
+  mutex_t(const mutex_t &) = delete;
+  mutex_t &operator=(const mutex_t &) = delete;
+
+  void lock() {
+    auto begin = std::chrono::steady_clock::now();
+
+    if(!_lock.try_lock()) {
+      _site->contended.fetch_add(1, std::memory_order_relaxed);
+      _lock.lock();
+    }
+
+    _locked_at = std::chrono::steady_clock::now();
+    _site->wait.record(_locked_at - begin);
+  }
+
+  bool try_lock() {
+    if(!_lock.try_lock()) {
+      return false;
+    }
+
+    _locked_at = std::chrono::steady_clock::now();
+    _site->wait.record(std::chrono::nanoseconds { 0 });
+
+    return true;
+  }
+
+  void unlock() {
+    _site->hold.record(std::chrono::steady_clock::now() - _locked_at);
+
+    _lock.unlock();
+  }
+
+  void site(lock_site_t site) {
+    _site = registry().site(site.name);
+  }
+
+private:
+  std::mutex _lock;
+  site_t *_site;
+
+  // Only accessed by the owner of _lock
+  std::chrono::steady_clock::time_point _locked_at;
+};
+
+// condition_variable only accepts std::unique_lock<std::mutex>
+using condition_variable_t = std::condition_variable_any;
+
+inline void name(mutex_t &mutex, lock_site_t site) {
+  mutex.site(site);
+}
+
+template<class M>
+void name(M &, lock_site_t) {}
+} // namespace lock_stats
+#else
+struct lock_site_t {
+  constexpr lock_site_t() = default;
+  constexpr lock_site_t(const char *) {}
+};
+
+namespace lock_stats {
+using mutex_t              = std::mutex;
+using condition_variable_t = std::condition_variable;
+
+template<class M>
+void name(M &, lock_site_t) {}
+} // namespace lock_stats
+#endif
+} // namespace util
+#endif
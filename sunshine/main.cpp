@@ -4,10 +4,12 @@
 
 #include "process.h"
 
+#include <algorithm>
 #include <csignal>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <sstream>
 #include <thread>
 
 #include <boost/log/attributes/clock.hpp>
@@ -19,6 +21,7 @@
 #include "config.h"
 #include "confighttp.h"
 #include "httpcommon.h"
+#include "init_phases.h"
 #include "main.h"
 #include "nvhttp.h"
 #include "rtsp.h"
@@ -63,12 +66,14 @@ void print_help(const char *name) {
     << std::endl
     << "    --help                    | print help"sv << std::endl
     << "    --creds username password | set user credentials for the Web manager" << std::endl
+    << "    --tune [WIDTHxHEIGHT ...] | measure the software encoder settings that keep up with each resolution" << std::endl
     << std::endl
     << "    flags"sv << std::endl
     << "        -0 | Read PIN from stdin"sv << std::endl
     << "        -1 | Do not load previously saved state and do retain any state after shutdown"sv << std::endl
     << "           | Effectively starting as if for the first time without overwriting any pairings with your devices"sv << std::endl
     << "        -2 | Force replacement of headers in video stream" << std::endl
+    << "        -3 | Probe the encoders again instead of using the results saved by a previous start" << std::endl
     << "        -p | Enable/Disable UPnP" << std::endl
     << std::endl;
 }
@@ -96,6 +101,16 @@ void on_signal(int sig, FN &&fn) {
   std::signal(sig, on_signal_forwarder);
 }
 
+#ifdef SUNSHINE_LOCK_STATS
+void log_lock_stats() {
+  std::stringstream ss;
+  util::lock_stats::dump(ss);
+
+  BOOST_LOG(info) << "Lock statistics:"sv << std::endl
+                  << ss.str();
+}
+#endif
+
 namespace gen_creds {
 int entry(const char *name, int argc, char *argv[]) {
   if(argc < 2 || argv[0] == "help"sv || argv[1] == "help"sv) {
@@ -109,9 +124,27 @@ int entry(const char *name, int argc, char *argv[]) {
 }
 } // namespace gen_creds
 
+namespace tune {
+int entry(const char *name, int argc, char *argv[]) {
+  if(argc > 0 && argv[0] == "help"sv) {
+    print_help(name);
+    return 0;
+  }
+
+  // A display may be needed to probe the software encoder
+  auto deinit_guard = platf::init();
+  if(!deinit_guard) {
+    return 4;
+  }
+
+  return video::tune({ argv, argv + argc }) ? 2 : 0;
+}
+} // namespace tune
+
 std::map<std::string_view, std::function<int(const char *name, int argc, char **argv)>> cmd_to_func {
   { "creds"sv, gen_creds::entry },
-  { "help"sv, help::entry }
+  { "help"sv, help::entry },
+  { "tune"sv, tune::entry }
 };
 
 int main(int argc, char *argv[]) {
@@ -132,7 +165,7 @@ int main(int argc, char *argv[]) {
     std::getline(std::cin, _);
   });
 
-  mail::man = std::make_shared<safe::mail_raw_t>();
+  mail::man = mail::make();
 
   if(config::parse(argc, argv)) {
     return 0;
@@ -208,7 +241,8 @@ int main(int argc, char *argv[]) {
     return fn->second(argv[0], config::sunshine.cmd.argc, config::sunshine.cmd.argv);
   }
 
-  task_pool.start(1);
+  // Input and other housekeeping stays serialized, the extra threads are for parallel work
+  task_pool.start(std::max(1u, std::thread::hardware_concurrency()));
 
   // Create signal handler after logging has been initialized
   auto shutdown_event = mail::man->event<bool>(mail::shutdown);
@@ -239,20 +273,50 @@ int main(int argc, char *argv[]) {
     shutdown_event->raise(true);
   });
 
-  proc::refresh(config::stream.file_apps);
+#if defined(SUNSHINE_LOCK_STATS) && defined(SIGUSR1)
+  on_signal(SIGUSR1, []() {
+    task_pool.post(log_lock_stats);
+  });
+#endif
 
-  auto deinit_guard = platf::init();
-  if(!deinit_guard) {
-    return 4;
-  }
+  std::unique_ptr<platf::deinit_t> deinit_guard;
+  std::unique_ptr<platf::deinit_t> input_deinit_guard;
 
-  reed_solomon_init();
-  auto input_deinit_guard = input::init();
-  if(video::init()) {
-    return 2;
-  }
-  if(http::init()) {
-    return 3;
+  util::init_phases_t init_phases;
+
+  // Added first to run on this thread, on Windows it initializes COM for the calling thread
+  init_phases.add("platform"sv, {}, [&deinit_guard]() {
+    deinit_guard = platf::init();
+    return deinit_guard ? 0 : 4;
+  });
+
+  init_phases.add("apps"sv, {}, []() {
+    proc::refresh(config::stream.file_apps);
+    return 0;
+  });
+
+  init_phases.add("fec"sv, {}, []() {
+    reed_solomon_init();
+    return 0;
+  });
+
+  init_phases.add("input"sv, { "platform"sv }, [&input_deinit_guard]() {
+    input_deinit_guard = input::init();
+    return 0;
+  });
+
+  // Probes the encoders
+  init_phases.add("video"sv, { "platform"sv }, []() {
+    return video::init() ? 2 : 0;
+  });
+
+  // May generate the key and certificate
+  init_phases.add("http"sv, {}, []() {
+    return http::init() ? 3 : 0;
+  });
+
+  if(auto status = init_phases.run()) {
+    return status;
   }
 
   std::unique_ptr<platf::deinit_t> mDNS;
@@ -275,12 +339,19 @@ int main(int argc, char *argv[]) {
 
   stream::rtpThread();
 
+  // The sessions have ended, don't wait for the displays they switched away from to cool down
+  video::release_displays();
+
   httpThread.join();
   configThread.join();
 
   task_pool.stop();
   task_pool.join();
 
+#ifdef SUNSHINE_LOCK_STATS
+  log_lock_stats();
+#endif
+
   return 0;
 }
 
@@ -31,26 +31,67 @@ int write_file(const char *path, const std::string_view &contents);
 
 std::uint16_t map_port(int port);
 
+namespace video {
+struct packet_raw_t;
+using packet_t = std::unique_ptr<packet_raw_t>;
+} // namespace video
+
+namespace audio {
+using packet_t = std::pair<void *, util::buffer_t<std::uint8_t>>;
+} // namespace audio
+
+namespace input {
+struct touch_port_t;
+} // namespace input
+
+namespace platf {
+struct rumble_t;
+} // namespace platf
+
 namespace mail {
-#define MAIL(x) \
-  constexpr auto x = std::string_view { #x }
+namespace id {
+enum id_e : std::size_t {
+  shutdown,
+  broadcast_shutdown,
+  video_packets,
+  audio_packets,
+  switch_display,
+  touch_port,
+  idr,
+  rumble,
+  MAX_MAIL
+};
+} // namespace id
+
+#define MAIL_EVENT(x, type) \
+  constexpr safe::event_key_t<type> x { id::x, "mail::" #x }
+
+#define MAIL_QUEUE(x, type, max_elements, overflow) \
+  constexpr safe::queue_key_t<type> x { id::x, max_elements, safe::overflow_e::overflow, "mail::" #x }
 
 extern safe::mail_t man;
 
 // Global mail
-MAIL(shutdown);
-MAIL(broadcast_shutdown);
+MAIL_EVENT(shutdown, bool);
+MAIL_EVENT(broadcast_shutdown, bool);
 
-MAIL(video_packets);
-MAIL(audio_packets);
+// Any lost video packet corrupts the stream until the next IDR frame anyway,
+// so start over from the most recent packet
+MAIL_QUEUE(video_packets, video::packet_t, 32, clear);
+MAIL_QUEUE(audio_packets, audio::packet_t, 32, drop_oldest);
 
-MAIL(switch_display);
+MAIL_EVENT(switch_display, int);
 
 // Local mail
-MAIL(touch_port);
-MAIL(idr);
-MAIL(rumble);
-#undef MAIL
+MAIL_EVENT(touch_port, input::touch_port_t);
+MAIL_EVENT(idr, bool);
+MAIL_QUEUE(rumble, platf::rumble_t, 32, drop_oldest);
+#undef MAIL_QUEUE
+#undef MAIL_EVENT
+
+inline safe::mail_t make() {
+  return std::make_shared<safe::mail_raw_t>(id::MAX_MAIL);
+}
 } // namespace mail
 
 
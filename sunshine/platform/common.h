@@ -5,11 +5,14 @@
 #ifndef SUNSHINE_COMMON_H
 #define SUNSHINE_COMMON_H
 
+#include <algorithm>
+#include <atomic>
 #include <bitset>
 #include <filesystem>
 #include <functional>
 #include <mutex>
 #include <string>
+#include <vector>
 
 #include "sunshine/thread_safe.h"
 #include "sunshine/utility.h"
@@ -124,6 +127,11 @@ struct touch_port_t {
   int width, height;
 };
 
+struct rect_t {
+  int x, y;
+  int width, height;
+};
+
 struct gamepad_state_t {
   std::uint16_t buttonFlags;
   std::uint8_t lt;
@@ -154,6 +162,24 @@ public:
   std::int32_t pixel_pitch {};
   std::int32_t row_pitch {};
 
+  /**
+   * Set by the display when nothing changed since the previous image passed to snapshot_cb.
+   * The display may skip filling an unchanged image, it then holds whatever was last captured into it.
+   */
+  bool unchanged {};
+
+  /**
+   * Set by the display: the areas that changed since the previous image passed to snapshot_cb.
+   * Empty when the whole image should be treated as changed.
+   */
+  std::vector<rect_t> damage;
+
+  /**
+   * Set by the capture loop: increases by one for every changed image of the display, 0 if unknown.
+   * Tells a consumer whether the damage is relative to the image it has seen last.
+   */
+  std::uint64_t capture_seq {};
+
   virtual ~img_t() = default;
 };
 
@@ -235,6 +261,29 @@ public:
     return std::make_shared<hwdevice_t>();
   }
 
+  /**
+   * Scale the images down to fit within width x height before they're read back into system memory.
+   * 0 x 0, or a size the display fits in, captures at the size of the display.
+   * Called by the capture thread between snapshots, alloc_img() allocates images of the new size from then on.
+   * The first image of the new size is changed as a whole, images allocated before are left unchanged.
+   *
+   * Returns true if the size of the images changed
+   */
+  virtual bool scale_to(int width, int height) {
+    return false;
+  }
+
+  /**
+   * The size of the images alloc_img() allocates
+   */
+  std::pair<int, int> img_size() const {
+    if(scaled_width) {
+      return { scaled_width, scaled_height };
+    }
+
+    return { width, height };
+  }
+
   virtual ~display_t() = default;
 
   // Offsets for when streaming a specific monitor. By default, they are 0.
@@ -242,6 +291,35 @@ public:
   int env_width, env_height;
 
   int width, height;
+
+protected:
+  /**
+   * For the backends that scale: fit the display within width x height, keeping the aspect ratio.
+   * Returns true if the size of the images changed
+   */
+  bool fit(int width, int height) {
+    int scaled_w {}, scaled_h {};
+    if(width > 0 && height > 0 && (width < this->width || height < this->height)) {
+      auto scale = std::min((double)width / this->width, (double)height / this->height);
+
+      // Even dimensions, the encoder subsamples the chroma
+      scaled_w = std::max(2, (int)(this->width * scale) & ~1);
+      scaled_h = std::max(2, (int)(this->height * scale) & ~1);
+    }
+
+    if(scaled_w == scaled_width && scaled_h == scaled_height) {
+      return false;
+    }
+
+    scaled_width  = scaled_w;
+    scaled_height = scaled_h;
+
+    return true;
+  }
+
+  // 0 while the images are the size of the display.
+  // Read by the sessions while the capture thread changes them
+  std::atomic_int scaled_width {}, scaled_height {};
 };
 
 class mic_t {
@@ -289,6 +367,12 @@ std::shared_ptr<display_t> display(mem_type_e hwdevice_type, const std::string &
 // A list of names of displays accepted as display_name with the mem_type_e
 std::vector<std::string> display_names(mem_type_e hwdevice_type);
 
+/**
+ * Identifies the GPUs, their drivers and the available ways of capturing the screen.
+ * The results of probing the encoders are reused for as long as it stays the same.
+ */
+std::string gpu_fingerprint();
+
 input_t input();
 void move_mouse(input_t &input, int deltaX, int deltaY);
 void abs_mouse(input_t &input, const touch_port_t &touch_port, float x, float y);
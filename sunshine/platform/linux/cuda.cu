@@ -70,7 +70,7 @@ struct __attribute__((__aligned__(16))) color_extern_t {
 
 static_assert(sizeof(video::color_t) == sizeof(video::color_extern_t), "color matrix struct mismatch");
 
-extern color_t colors[4];
+extern color_t colors[6];
 } // namespace video
 
 //////////////////// End special declarations
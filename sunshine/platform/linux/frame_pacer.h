@@ -0,0 +1,144 @@
+#ifndef SUNSHINE_PLATFORM_LINUX_FRAME_PACER_H
+#define SUNSHINE_PLATFORM_LINUX_FRAME_PACER_H
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <time.h>
+
+#include "sunshine/main.h"
+
+namespace platf {
+/**
+ * Paces the capture loops of the Linux backends.
+ *
+ * The deadlines are absolute, each one is the previous one plus the frame interval,
+ * so the time spent capturing doesn't accumulate as drift.
+ * The thread sleeps in clock_nanosleep until shortly before the deadline,
+ * then spins for the remainder, which is calibrated against how late the kernel wakes it.
+ */
+class frame_pacer_t {
+public:
+  using clock = std::chrono::steady_clock;
+
+  /**
+   * delay --> The frame interval
+   * max_spin --> The most time spent spinning before a deadline, 0 to only sleep
+   */
+  explicit frame_pacer_t(std::chrono::nanoseconds delay, std::chrono::nanoseconds max_spin = std::chrono::microseconds { 500 })
+      : _delay { delay }, _max_spin { max_spin } {}
+
+  /**
+   * Wait for the next deadline.
+   * If the caller fell behind by more than a frame, the schedule restarts from now instead of capturing the missed frames in a burst.
+   */
+  void wait() {
+    using namespace std::literals;
+
+    auto now = clock::now();
+    if(_next == clock::time_point {}) {
+      _next = now;
+      _stats.next_report = now + 10s;
+    }
+    else if(now - _next > _delay) {
+      _next = now;
+      ++_stats.missed;
+    }
+
+    if(_next - _spin > now) {
+      auto wake = _next - _spin;
+      sleep_until(wake);
+
+      now = clock::now();
+
+      // Track how late the kernel wakes the thread, the spin covers that much
+      auto late = std::max(now - wake, 0ns);
+      _oversleep += (late - _oversleep) / 8;
+      _spin = std::clamp(_oversleep * 3 / 2, 0ns, _max_spin);
+    }
+
+    while(_next > now) {
+      now = clock::now();
+    }
+
+    sample(now);
+
+    _next += _delay;
+  }
+
+  /**
+   * The next call to wait() returns immediately and starts a new schedule
+   */
+  void reset() {
+    _next = {};
+    _last = {};
+  }
+
+private:
+  static void sleep_until(clock::time_point tp) {
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(tp.time_since_epoch()).count();
+
+    // steady_clock is CLOCK_MONOTONIC
+    timespec ts {
+      (time_t)(ns / 1000000000),
+      (long)(ns % 1000000000),
+    };
+
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR)
+      ;
+  }
+
+  /**
+   * Record how far the interval between two captures strayed from the frame interval,
+   * log it every 10 seconds
+   */
+  void sample(clock::time_point now) {
+    using namespace std::literals;
+
+    if(_last != clock::time_point {}) {
+      auto jitter = std::chrono::abs(now - _last - _delay);
+
+      _stats.total += jitter;
+      _stats.max = std::max(_stats.max, jitter);
+      ++_stats.frames;
+    }
+    _last = now;
+
+    if(now < _stats.next_report) {
+      return;
+    }
+
+    if(_stats.frames) {
+      BOOST_LOG(debug)
+        << "Capture interval jitter: average "sv << std::chrono::duration<double, std::micro>(_stats.total / _stats.frames).count()
+        << "us, max "sv << std::chrono::duration<double, std::micro>(_stats.max).count()
+        << "us, spin "sv << std::chrono::duration<double, std::micro>(_spin).count()
+        << "us, "sv << _stats.missed << " missed deadlines"sv;
+    }
+
+    _stats = { 0ns, 0ns, 0, 0, now + 10s };
+  }
+
+  std::chrono::nanoseconds _delay;
+  std::chrono::nanoseconds _max_spin;
+
+  // Running average of how late clock_nanosleep returns, and the spin derived from it
+  std::chrono::nanoseconds _oversleep {};
+  std::chrono::nanoseconds _spin {};
+
+  clock::time_point _next;
+  clock::time_point _last;
+
+  struct {
+    std::chrono::nanoseconds total;
+    std::chrono::nanoseconds max;
+    int frames;
+    int missed;
+
+    clock::time_point next_report;
+  } _stats {};
+};
+} // namespace platf
+
+#endif
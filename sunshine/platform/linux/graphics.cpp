@@ -859,6 +859,62 @@ int sws_t::convert(gl::frame_buf_t &fb) {
 
   return 0;
 }
+
+int readback_t::read(GLuint texture, int offset_x, int offset_y, int width, int height, platf::img_t &img) {
+  if(img.width == width && img.height == height) {
+    gl::ctx.BindTexture(GL_TEXTURE_2D, texture);
+    gl::ctx.GetTextureSubImage(texture, 0, offset_x, offset_y, 0, width, height, 1, GL_BGRA, GL_UNSIGNED_BYTE, img.height * img.row_pitch, img.data);
+    gl::ctx.BindTexture(GL_TEXTURE_2D, 0);
+
+    return 0;
+  }
+
+  if(!tex.size() || out_width != img.width || out_height != img.height) {
+    tex = gl::tex_t::make(1);
+    gl::ctx.BindTexture(GL_TEXTURE_2D, tex[0]);
+    gl::ctx.TexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, img.width, img.height);
+    gl::ctx.BindTexture(GL_TEXTURE_2D, 0);
+
+    if(!framebuffer.size()) {
+      framebuffer = gl::frame_buf_t::make(2);
+    }
+
+    out_width  = img.width;
+    out_height = img.height;
+
+    BOOST_LOG(info) << "Scaling "sv << width << 'x' << height << " down to "sv << out_width << 'x' << out_height << " before reading it back"sv;
+  }
+
+  gl::ctx.BindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer[0]);
+  gl::ctx.FramebufferTexture(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, texture, 0);
+  gl::ctx.BindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer[1]);
+  gl::ctx.FramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, tex[0], 0);
+
+#ifndef NDEBUG
+  for(auto target : { GL_READ_FRAMEBUFFER, GL_DRAW_FRAMEBUFFER }) {
+    auto status = gl::ctx.CheckFramebufferStatus(target);
+    if(status != GL_FRAMEBUFFER_COMPLETE) {
+      BOOST_LOG(error) << "Readback: CheckFramebufferStatus() --> [0x"sv << util::hex(status).to_string_view() << ']';
+      return -1;
+    }
+  }
+#endif
+
+  gl::ctx.BlitFramebuffer(
+    offset_x, offset_y, offset_x + width, offset_y + height,
+    0, 0, out_width, out_height,
+    GL_COLOR_BUFFER_BIT, GL_LINEAR);
+
+  gl::ctx.BindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  gl::ctx.BindTexture(GL_TEXTURE_2D, tex[0]);
+  gl::ctx.GetTextureSubImage(tex[0], 0, 0, 0, 0, out_width, out_height, 1, GL_BGRA, GL_UNSIGNED_BYTE, img.height * img.row_pitch, img.data);
+  gl::ctx.BindTexture(GL_TEXTURE_2D, 0);
+
+  gl_drain_errors;
+
+  return 0;
+}
 } // namespace egl
 
 void free_frame(AVFrame *frame) {
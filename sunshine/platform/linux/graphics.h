@@ -313,6 +313,29 @@ public:
   std::uint64_t serial;
 };
 
+/**
+ * Reads an area of a texture back into system memory.
+ * An image smaller than the area is scaled down on the GPU first,
+ * the copy into system memory then costs as much as the image instead of the area.
+ */
+class readback_t {
+public:
+  /**
+   * texture --> The texture read from
+   * offset_x, offset_y, width, height --> The area read from the texture
+   * img <-- The destination image, of the size of the area or smaller
+   */
+  int read(GLuint texture, int offset_x, int offset_y, int width, int height, platf::img_t &img);
+
+  // The scaled image, created for the size of the last image that was smaller than the area
+  gl::tex_t tex;
+
+  // The texture read from, and the scaled image
+  gl::frame_buf_t framebuffer;
+
+  int out_width, out_height;
+};
+
 bool fail();
 } // namespace egl
 
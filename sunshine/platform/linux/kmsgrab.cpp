@@ -10,10 +10,12 @@
 
 #include "sunshine/main.h"
 #include "sunshine/platform/common.h"
+#include "sunshine/platform/tile_hash.h"
 #include "sunshine/round_robin.h"
 #include "sunshine/utility.h"
 
 // Cursor rendering support through x11
+#include "frame_pacer.h"
 #include "graphics.h"
 #include "vaapi.h"
 #include "wayland.h"
@@ -657,19 +659,10 @@ public:
   }
 
   capture_e capture(snapshot_cb_t &&snapshot_cb, std::shared_ptr<img_t> img, bool *cursor) override {
-    auto next_frame = std::chrono::steady_clock::now();
+    frame_pacer_t pacer { delay };
 
     while(img) {
-      auto now = std::chrono::steady_clock::now();
-
-      if(next_frame > now) {
-        std::this_thread::sleep_for((next_frame - now) / 3 * 2);
-      }
-      while(next_frame > now) {
-        std::this_thread::sleep_for(1ns);
-        now = std::chrono::steady_clock::now();
-      }
-      next_frame = now + delay;
+      pacer.wait();
 
       auto status = snapshot(img.get(), 1000ms, *cursor);
       switch(status) {
@@ -717,23 +710,40 @@ public:
 
     auto &rgb = *rgb_opt;
 
-    gl::ctx.BindTexture(GL_TEXTURE_2D, rgb->tex[0]);
-    gl::ctx.GetTextureSubImage(rgb->tex[0], 0, img_offset_x, img_offset_y, 0, width, height, 1, GL_BGRA, GL_UNSIGNED_BYTE, img_out_base->height * img_out_base->row_pitch, img_out_base->data);
+    if(readback.read(rgb->tex[0], img_offset_x, img_offset_y, width, height, *img_out_base)) {
+      return capture_e::error;
+    }
 
     if(cursor_opt && cursor) {
-      cursor_opt->blend(*img_out_base, img_offset_x, img_offset_y);
+      cursor_opt->blend(*img_out_base, img_offset_x, img_offset_y, (float)img_out_base->width / width);
     }
 
+    // KMS doesn't report damage, compositors may even draw into the framebuffer being scanned out
+    img_out_base->unchanged = !hash.update(*img_out_base);
+
     return capture_e::ok;
   }
 
+  bool scale_to(int width, int height) override {
+    if(!fit(width, height)) {
+      return false;
+    }
+
+    // The first image of the new size is changed as a whole
+    hash.reset();
+
+    return true;
+  }
+
   std::shared_ptr<img_t> alloc_img() override {
+    auto [out_width, out_height] = img_size();
+
     auto img         = std::make_shared<kms_img_t>();
-    img->width       = width;
-    img->height      = height;
+    img->width       = out_width;
+    img->height      = out_height;
     img->pixel_pitch = 4;
-    img->row_pitch   = img->pixel_pitch * width;
-    img->data        = new std::uint8_t[height * img->row_pitch];
+    img->row_pitch   = img->pixel_pitch * out_width;
+    img->data        = new std::uint8_t[out_height * img->row_pitch];
 
     return img;
   }
@@ -745,6 +755,10 @@ public:
   gbm::gbm_t gbm;
   egl::display_t display;
   egl::ctx_t ctx;
+
+  egl::readback_t readback;
+
+  tile_hash_t hash;
 };
 
 class display_vram_t : public display_t {
@@ -778,19 +792,10 @@ public:
   }
 
   capture_e capture(snapshot_cb_t &&snapshot_cb, std::shared_ptr<img_t> img, bool *cursor) {
-    auto next_frame = std::chrono::steady_clock::now();
+    frame_pacer_t pacer { delay };
 
     while(img) {
-      auto now = std::chrono::steady_clock::now();
-
-      if(next_frame > now) {
-        std::this_thread::sleep_for((next_frame - now) / 3 * 2);
-      }
-      while(next_frame > now) {
-        std::this_thread::sleep_for(1ns);
-        now = std::chrono::steady_clock::now();
-      }
-      next_frame = now + delay;
+      pacer.wait();
 
       auto status = snapshot(img.get(), 1000ms, *cursor);
       switch(status) {
@@ -3,9 +3,11 @@
 #include <fcntl.h>
 #include <ifaddrs.h>
 #include <pwd.h>
+#include <sys/utsname.h>
 #include <unistd.h>
 
 #include <fstream>
+#include <sstream>
 
 #include "graphics.h"
 #include "misc.h"
@@ -213,6 +215,71 @@ std::vector<std::string> display_names(mem_type_e hwdevice_type) {
   return {};
 }
 
+static std::string read_line(const fs::path &path) {
+  std::ifstream file(path);
+
+  std::string line;
+  std::getline(file, line);
+
+  return line;
+}
+
+std::string gpu_fingerprint() {
+  std::vector<std::string> cards;
+
+  std::error_code ec;
+  for(auto &entry : fs::directory_iterator { "/sys/class/drm", ec }) {
+    auto name = entry.path().filename().string();
+
+    // Skip the connectors, such as card0-DP-1, and the render nodes
+    if(name.rfind("card"sv, 0) != 0 || name.find('-') != std::string::npos) {
+      continue;
+    }
+
+    auto device = entry.path() / "device";
+    auto driver = fs::read_symlink(device / "driver", ec).filename().string();
+
+    // The VAAPI drivers live in userspace, such as Mesa or intel-media-driver, they're upgraded without the kernel
+    std::string va_driver;
+    for(auto &node : fs::directory_iterator { device / "drm", ec }) {
+      auto node_name = node.path().filename().string();
+      if(node_name.rfind("renderD"sv, 0) != 0) {
+        continue;
+      }
+
+      file_t file = open(("/dev/dri/" + node_name).c_str(), O_RDWR);
+      if(file.el >= 0) {
+        va_driver = va::driver_version(file.el);
+      }
+
+      break;
+    }
+
+    // Drivers outside the kernel, such as nvidia, have a version of their own, their userspace libraries must match it
+    cards.emplace_back(
+      name + ':' + read_line(device / "vendor") + ':' + read_line(device / "device") + ':' +
+      driver + ':' + read_line(fs::path { "/sys/module" } / driver / "version") + ':' + va_driver);
+  }
+
+  std::sort(std::begin(cards), std::end(cards));
+
+  std::stringstream ss;
+
+  // The drivers inside the kernel change with it
+  utsname kernel;
+  if(!uname(&kernel)) {
+    ss << kernel.release << ';';
+  }
+
+  for(auto &card : cards) {
+    ss << card << ';';
+  }
+
+  ss << sources.to_string();
+
+  return ss.str();
+}
+
 std::shared_ptr<display_t> display(mem_type_e hwdevice_type, const std::string &display_name, int framerate) {
 #ifdef SUNSHINE_BUILD_CUDA
   if(sources[source::NVFBC] && hwdevice_type == mem_type_e::cuda) {
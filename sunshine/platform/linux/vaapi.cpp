@@ -611,6 +611,24 @@ bool validate(int fd) {
   return true;
 }
 
+std::string driver_version(int fd) {
+  if(init()) {
+    return {};
+  }
+
+  va::display_t display { va::getDisplayDRM(fd) };
+  if(!display) {
+    return {};
+  }
+
+  int major, minor;
+  if(initialize(display.get(), &major, &minor)) {
+    return {};
+  }
+
+  return std::to_string(major) + '.' + std::to_string(minor) + ' ' + queryVendorString(display.get());
+}
+
 std::shared_ptr<platf::hwdevice_t> make_hwdevice(int width, int height, file_t &&card, int offset_x, int offset_y, bool vram) {
   if(vram) {
     auto egl = std::make_shared<va::va_vram_t>();
@@ -22,6 +22,10 @@ std::shared_ptr<platf::hwdevice_t> make_hwdevice(int width, int height, file_t &
 // Ensure the render device pointed to by fd is capable of encoding h264 with the hevc_mode configured
 bool validate(int fd);
 
+// The version of libva and the vendor string of the driver, which carries its version, for the render device pointed to by fd.
+// Empty if the device has no VAAPI driver
+std::string driver_version(int fd);
+
 int init();
 } // namespace va
 #endif
\ No newline at end of file
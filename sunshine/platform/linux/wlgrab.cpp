@@ -1,6 +1,8 @@
 #include "sunshine/platform/common.h"
 
 #include "sunshine/main.h"
+#include "sunshine/platform/tile_hash.h"
+#include "frame_pacer.h"
 #include "vaapi.h"
 #include "wayland.h"
 
@@ -115,18 +117,10 @@ public:
 class wlr_ram_t : public wlr_t {
 public:
   platf::capture_e capture(snapshot_cb_t &&snapshot_cb, std::shared_ptr<platf::img_t> img, bool *cursor) override {
-    auto next_frame = std::chrono::steady_clock::now();
+    platf::frame_pacer_t pacer { delay };
 
     while(img) {
-      auto now = std::chrono::steady_clock::now();
-
-      if(next_frame > now) {
-        std::this_thread::sleep_for((next_frame - now) / 3 * 2);
-      }
-      while(next_frame > now) {
-        now = std::chrono::steady_clock::now();
-      }
-      next_frame = now + delay;
+      pacer.wait();
 
       auto status = snapshot(img.get(), 1000ms, *cursor);
       switch(status) {
@@ -161,9 +155,11 @@ public:
       return platf::capture_e::reinit;
     }
 
-    gl::ctx.BindTexture(GL_TEXTURE_2D, (*rgb_opt)->tex[0]);
-    gl::ctx.GetTextureSubImage((*rgb_opt)->tex[0], 0, 0, 0, 0, width, height, 1, GL_BGRA, GL_UNSIGNED_BYTE, img_out_base->height * img_out_base->row_pitch, img_out_base->data);
-    gl::ctx.BindTexture(GL_TEXTURE_2D, 0);
+    if(readback.read((*rgb_opt)->tex[0], 0, 0, width, height, *img_out_base)) {
+      return platf::capture_e::error;
+    }
+
+    img_out_base->unchanged = !hash.update(*img_out_base);
 
     return platf::capture_e::ok;
   }
@@ -196,36 +192,45 @@ public:
     return std::make_shared<platf::hwdevice_t>();
   }
 
+  bool scale_to(int width, int height) override {
+    if(!fit(width, height)) {
+      return false;
+    }
+
+    // The first image of the new size is changed as a whole
+    hash.reset();
+
+    return true;
+  }
+
   std::shared_ptr<platf::img_t> alloc_img() override {
+    auto [out_width, out_height] = img_size();
+
     auto img         = std::make_shared<img_t>();
-    img->width       = width;
-    img->height      = height;
+    img->width       = out_width;
+    img->height      = out_height;
     img->pixel_pitch = 4;
-    img->row_pitch   = img->pixel_pitch * width;
-    img->data        = new std::uint8_t[height * img->row_pitch];
+    img->row_pitch   = img->pixel_pitch * out_width;
+    img->data        = new std::uint8_t[out_height * img->row_pitch];
 
     return img;
   }
 
   egl::display_t egl_display;
   egl::ctx_t ctx;
+
+  egl::readback_t readback;
+
+  platf::tile_hash_t hash;
 };
 
 class wlr_vram_t : public wlr_t {
 public:
   platf::capture_e capture(snapshot_cb_t &&snapshot_cb, std::shared_ptr<platf::img_t> img, bool *cursor) override {
-    auto next_frame = std::chrono::steady_clock::now();
+    platf::frame_pacer_t pacer { delay };
 
     while(img) {
-      auto now = std::chrono::steady_clock::now();
-
-      if(next_frame > now) {
-        std::this_thread::sleep_for((next_frame - now) / 3 * 2);
-      }
-      while(next_frame > now) {
-        now = std::chrono::steady_clock::now();
-      }
-      next_frame = now + delay;
+      pacer.wait();
 
       auto status = snapshot(img.get(), 1000ms, *cursor);
       switch(status) {
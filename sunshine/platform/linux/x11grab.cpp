@@ -9,8 +9,10 @@
 #include <X11/X.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
+#include <X11/extensions/Xdamage.h>
 #include <X11/extensions/Xfixes.h>
 #include <X11/extensions/Xrandr.h>
+#include <X11/extensions/Xrender.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
 #include <xcb/shm.h>
@@ -18,9 +20,11 @@
 
 #include "sunshine/config.h"
 #include "sunshine/main.h"
+#include "sunshine/platform/tile_hash.h"
 #include "sunshine/task_pool.h"
 
 #include "cuda.h"
+#include "frame_pacer.h"
 #include "graphics.h"
 #include "misc.h"
 #include "vaapi.h"
@@ -56,6 +60,10 @@ _FN(GetWindowAttributes, Status,
 _FN(CloseDisplay, int, (Display * display));
 _FN(Free, int, (void *data));
 _FN(InitThreads, Status, (void));
+_FN(CheckTypedEvent, Bool, (Display * display, int event_type, XEvent *event_return));
+_FN(CreatePixmap, Pixmap, (Display * display, Drawable d, unsigned int width, unsigned int height, unsigned int depth));
+_FN(FreePixmap, int, (Display * display, Pixmap pixmap));
+_FN(Sync, int, (Display * display, Bool discard));
 
 namespace rr {
 _FN(GetScreenResources, XRRScreenResources *, (Display * dpy, Window window));
@@ -98,6 +106,9 @@ int init() {
 } // namespace rr
 namespace fix {
 _FN(GetCursorImage, XFixesCursorImage *, (Display * dpy));
+_FN(CreateRegion, XserverRegion, (Display * dpy, XRectangle *rectangles, int nrectangles));
+_FN(DestroyRegion, void, (Display * dpy, XserverRegion region));
+_FN(FetchRegion, XRectangle *, (Display * dpy, XserverRegion region, int *nrectanglesRet));
 
 int init() {
   static void *handle { nullptr };
@@ -114,6 +125,9 @@ int init() {
 
   std::vector<std::tuple<dyn::apiproc *, const char *>> funcs {
     { (dyn::apiproc *)&GetCursorImage, "XFixesGetCursorImage" },
+    { (dyn::apiproc *)&CreateRegion, "XFixesCreateRegion" },
+    { (dyn::apiproc *)&DestroyRegion, "XFixesDestroyRegion" },
+    { (dyn::apiproc *)&FetchRegion, "XFixesFetchRegion" },
   };
 
   if(dyn::load(handle, funcs)) {
@@ -125,6 +139,94 @@ int init() {
 }
 } // namespace fix
 
+namespace damage {
+_FN(QueryExtension, Bool, (Display * dpy, int *event_base_return, int *error_base_return));
+_FN(Create, Damage, (Display * dpy, Drawable drawable, int level));
+_FN(Destroy, void, (Display * dpy, Damage damage));
+_FN(Subtract, void, (Display * dpy, Damage damage, XserverRegion repair, XserverRegion parts));
+
+int init() {
+  static void *handle { nullptr };
+  static bool funcs_loaded = false;
+
+  if(funcs_loaded) return 0;
+
+  if(!handle) {
+    handle = dyn::handle({ "libXdamage.so.1", "libXdamage.so" });
+    if(!handle) {
+      return -1;
+    }
+  }
+
+  std::vector<std::tuple<dyn::apiproc *, const char *>> funcs {
+    { (dyn::apiproc *)&QueryExtension, "XDamageQueryExtension" },
+    { (dyn::apiproc *)&Create, "XDamageCreate" },
+    { (dyn::apiproc *)&Destroy, "XDamageDestroy" },
+    { (dyn::apiproc *)&Subtract, "XDamageSubtract" },
+  };
+
+  if(dyn::load(handle, funcs)) {
+    return -1;
+  }
+
+  funcs_loaded = true;
+  return 0;
+}
+} // namespace damage
+
+namespace render {
+_FN(FindVisualFormat, XRenderPictFormat *, (Display * dpy, _Xconst Visual *visual));
+_FN(CreatePicture, Picture,
+  (
+    Display * dpy,
+    Drawable drawable,
+    _Xconst XRenderPictFormat *format,
+    unsigned long valuemask,
+    _Xconst XRenderPictureAttributes *attributes));
+_FN(FreePicture, void, (Display * dpy, Picture picture));
+_FN(SetPictureTransform, void, (Display * dpy, Picture picture, XTransform *transform));
+_FN(SetPictureFilter, void, (Display * dpy, Picture picture, const char *filter, XFixed *params, int nparams));
+_FN(Composite, void,
+  (
+    Display * dpy,
+    int op,
+    Picture src, Picture mask, Picture dst,
+    int src_x, int src_y,
+    int mask_x, int mask_y,
+    int dst_x, int dst_y,
+    unsigned int width, unsigned int height));
+
+int init() {
+  static void *handle { nullptr };
+  static bool funcs_loaded = false;
+
+  if(funcs_loaded) return 0;
+
+  if(!handle) {
+    handle = dyn::handle({ "libXrender.so.1", "libXrender.so" });
+    if(!handle) {
+      return -1;
+    }
+  }
+
+  std::vector<std::tuple<dyn::apiproc *, const char *>> funcs {
+    { (dyn::apiproc *)&FindVisualFormat, "XRenderFindVisualFormat" },
+    { (dyn::apiproc *)&CreatePicture, "XRenderCreatePicture" },
+    { (dyn::apiproc *)&FreePicture, "XRenderFreePicture" },
+    { (dyn::apiproc *)&SetPictureTransform, "XRenderSetPictureTransform" },
+    { (dyn::apiproc *)&SetPictureFilter, "XRenderSetPictureFilter" },
+    { (dyn::apiproc *)&Composite, "XRenderComposite" },
+  };
+
+  if(dyn::load(handle, funcs)) {
+    return -1;
+  }
+
+  funcs_loaded = true;
+  return 0;
+}
+} // namespace render
+
 int init() {
   static void *handle { nullptr };
   static bool funcs_loaded = false;
@@ -145,6 +247,10 @@ int init() {
     { (dyn::apiproc *)&Free, "XFree" },
     { (dyn::apiproc *)&CloseDisplay, "XCloseDisplay" },
     { (dyn::apiproc *)&InitThreads, "XInitThreads" },
+    { (dyn::apiproc *)&CheckTypedEvent, "XCheckTypedEvent" },
+    { (dyn::apiproc *)&CreatePixmap, "XCreatePixmap" },
+    { (dyn::apiproc *)&FreePixmap, "XFreePixmap" },
+    { (dyn::apiproc *)&Sync, "XSync" },
   };
 
   if(dyn::load(handle, funcs)) {
@@ -313,14 +419,10 @@ struct shm_img_t : public img_t {
   }
 };
 
-static void blend_cursor(Display *display, img_t &img, int offsetX, int offsetY) {
-  xcursor_t overlay { x11::fix::GetCursorImage(display) };
-
-  if(!overlay) {
-    BOOST_LOG(error) << "Couldn't get cursor from XFixesGetCursorImage"sv;
-    return;
-  }
-
+/**
+ * scale --> The size of img relative to the captured area, the cursor is scaled along with it
+ */
+static void blend_cursor(XFixesCursorImage *overlay, img_t &img, int offsetX, int offsetY, float scale) {
   overlay->x -= overlay->xhot;
   overlay->y -= overlay->yhot;
 
@@ -335,15 +437,21 @@ static void blend_cursor(Display *display, img_t &img, int offsetX, int offsetY)
   auto screen_height = img.height;
   auto screen_width  = img.width;
 
-  auto delta_height = std::min<uint16_t>(overlay->height, std::max(0, screen_height - overlay->y));
-  auto delta_width  = std::min<uint16_t>(overlay->width, std::max(0, screen_width - overlay->x));
+  int cursor_x      = overlay->x * scale;
+  int cursor_y      = overlay->y * scale;
+  int cursor_width  = std::max(1, (int)(overlay->width * scale));
+  int cursor_height = std::max(1, (int)(overlay->height * scale));
+
+  auto delta_height = std::min(cursor_height, std::max(0, screen_height - cursor_y));
+  auto delta_width  = std::min(cursor_width, std::max(0, screen_width - cursor_x));
   for(auto y = 0; y < delta_height; ++y) {
-    auto overlay_begin = &overlay->pixels[y * overlay->width];
-    auto overlay_end   = &overlay->pixels[y * overlay->width + delta_width];
+    auto overlay_row = &overlay->pixels[std::min((int)(y / scale), overlay->height - 1) * overlay->width];
+
+    auto pixels_begin = &pixels[(y + cursor_y) * (img.row_pitch / img.pixel_pitch) + cursor_x];
 
-    auto pixels_begin = &pixels[(y + overlay->y) * (img.row_pitch / img.pixel_pitch) + overlay->x];
+    for(auto x = 0; x < delta_width; ++x) {
+      long pixel = overlay_row[std::min((int)(x / scale), overlay->width - 1)];
 
-    std::for_each(overlay_begin, overlay_end, [&](long pixel) {
       int *pixel_p = (int *)&pixel;
 
       auto colors_in = (uint8_t *)pixels_begin;
@@ -359,10 +467,203 @@ static void blend_cursor(Display *display, img_t &img, int offsetX, int offsetY)
         colors_in[2]    = colors_out[2] + (colors_in[2] * (255 - alpha) + 255 / 2) / 255;
       }
       ++pixels_begin;
-    });
+    }
+  }
+}
+
+static void blend_cursor(Display *display, img_t &img, int offsetX, int offsetY, float scale) {
+  xcursor_t overlay { x11::fix::GetCursorImage(display) };
+
+  if(!overlay) {
+    BOOST_LOG(error) << "Couldn't get cursor from XFixesGetCursorImage"sv;
+    return;
   }
+
+  blend_cursor(overlay.get(), img, offsetX, offsetY, scale);
 }
 
+/**
+ * Decides whether the captured area changed since the previous image.
+ *
+ * With XDamage, an unchanged area doesn't need to be read back at all.
+ * Without it, every image is read back and compared by its tile hashes.
+ * The cursor is blended in by Sunshine, so XDamage doesn't see it move.
+ *
+ * The tracker has its own connection, the damage events can't interfere with the other users of the display.
+ */
+class damage_tracker_t {
+public:
+  damage_tracker_t() = default;
+  damage_tracker_t(const damage_tracker_t &) = delete;
+  damage_tracker_t &operator=(const damage_tracker_t &) = delete;
+
+  ~damage_tracker_t() {
+    reset();
+  }
+
+  void init(int offset_x, int offset_y, int width, int height) {
+    reset();
+
+    _area = { (short)offset_x, (short)offset_y, (unsigned short)width, (unsigned short)height };
+
+    _display.reset(x11::OpenDisplay(nullptr));
+
+    int error_base;
+    if(!_display || x11::damage::init() || !x11::damage::QueryExtension(_display.get(), &_event_base, &error_base)) {
+      BOOST_LOG(info) << "XDamage not available, detecting changes by hashing the captured image"sv;
+      return;
+    }
+
+    _damage = x11::damage::Create(_display.get(), DefaultRootWindow(_display.get()), XDamageReportNonEmpty);
+    _parts  = x11::fix::CreateRegion(_display.get(), nullptr, 0);
+  }
+
+  /**
+   * overlay --> The cursor about to be blended in, nullptr when it won't be
+   * @return true if the captured area or the cursor may have changed since the previous call
+   */
+  bool update(const XFixesCursorImage *overlay) {
+    _rects.clear();
+
+    cursor_state_t cursor {};
+    if(overlay) {
+      cursor = {
+        true,
+        overlay->x,
+        overlay->y,
+        overlay->cursor_serial,
+        { overlay->x - overlay->xhot - _area.x, overlay->y - overlay->yhot - _area.y, overlay->width, overlay->height },
+      };
+    }
+
+    auto prev_cursor    = std::exchange(_cursor, cursor);
+    auto cursor_changed = prev_cursor != cursor;
+
+    if(!_damage) {
+      return true;
+    }
+
+    x11::damage::Subtract(_display.get(), _damage, None, _parts);
+
+    int count;
+    XRectangle *parts = x11::fix::FetchRegion(_display.get(), _parts, &count);
+
+    // The reply to FetchRegion is preceded by any DamageNotify event, they're no longer needed
+    XEvent event;
+    while(x11::CheckTypedEvent(_display.get(), _event_base + XDamageNotify, &event)) {}
+
+    for(int x = 0; x < count; ++x) {
+      auto &part = parts[x];
+
+      auto left   = std::max<int>(part.x, _area.x);
+      auto top    = std::max<int>(part.y, _area.y);
+      auto right  = std::min<int>(part.x + part.width, _area.x + _area.width);
+      auto bottom = std::min<int>(part.y + part.height, _area.y + _area.height);
+
+      if(left < right && top < bottom) {
+        _rects.emplace_back(rect_t { left - _area.x, top - _area.y, right - left, bottom - top });
+      }
+    }
+
+    if(parts) {
+      x11::Free(parts);
+    }
+
+    if(cursor_changed) {
+      for(auto state : { &prev_cursor, &cursor }) {
+        if(state->visible) {
+          _rects.emplace_back(state->rect);
+        }
+      }
+    }
+
+    // Nothing has been captured before, the whole image is new
+    if(std::exchange(_first, false)) {
+      _rects.clear();
+
+      return true;
+    }
+
+    return cursor_changed || !_rects.empty();
+  }
+
+  /**
+   * Set img.unchanged and img.damage, after img has been read back
+   */
+  void apply(img_t &img) {
+    if(!_damage) {
+      img.unchanged = !_hash.update(img);
+
+      return;
+    }
+
+    img.unchanged = false;
+    img.damage    = _rects;
+
+    // The image is scaled down from the captured area, the changed areas are rounded outwards
+    if(img.width != _area.width || img.height != _area.height) {
+      for(auto &rect : img.damage) {
+        auto left   = rect.x * img.width / _area.width;
+        auto top    = rect.y * img.height / _area.height;
+        auto right  = ((rect.x + rect.width) * img.width + _area.width - 1) / _area.width;
+        auto bottom = ((rect.y + rect.height) * img.height + _area.height - 1) / _area.height;
+
+        rect = { left, top, std::min(right, img.width) - left, std::min(bottom, img.height) - top };
+      }
+    }
+  }
+
+  /**
+   * The next image is changed as a whole, e.g. because the images are scaled to another size
+   */
+  void invalidate() {
+    _first = true;
+    _hash.reset();
+  }
+
+private:
+  void reset() {
+    if(_damage) {
+      x11::damage::Destroy(_display.get(), _damage);
+      x11::fix::DestroyRegion(_display.get(), _parts);
+
+      _damage = 0;
+    }
+
+    invalidate();
+  }
+
+  struct cursor_state_t {
+    bool visible;
+    short x, y;
+    unsigned long serial;
+
+    // Follows from the members above
+    rect_t rect;
+
+    bool operator!=(const cursor_state_t &other) const {
+      return visible != other.visible || x != other.x || y != other.y || serial != other.serial;
+    }
+  };
+
+  x11::xdisplay_t _display;
+  XRectangle _area {};
+
+  Damage _damage {};
+  XserverRegion _parts {};
+  int _event_base {};
+
+  // Nothing has been captured yet
+  bool _first { true };
+
+  cursor_state_t _cursor {};
+
+  // The changed areas in image coordinates
+  std::vector<rect_t> _rects;
+
+  tile_hash_t _hash;
+};
+
 struct x11_attr_t : public display_t {
   std::chrono::nanoseconds delay;
 
@@ -372,6 +673,8 @@ struct x11_attr_t : public display_t {
 
   mem_type_e mem_type;
 
+  damage_tracker_t damage;
+
   /*
    * Last X (NOT the streamed monitor!) size.
    * This way we can trigger reinitialization if the dimensions changed while streaming
@@ -445,6 +748,8 @@ struct x11_attr_t : public display_t {
     env_width  = xattr.width;
     env_height = xattr.height;
 
+    damage.init(offset_x, offset_y, width, height);
+
     return 0;
   }
 
@@ -456,19 +761,10 @@ struct x11_attr_t : public display_t {
   }
 
   capture_e capture(snapshot_cb_t &&snapshot_cb, std::shared_ptr<img_t> img, bool *cursor) override {
-    auto next_frame = std::chrono::steady_clock::now();
+    frame_pacer_t pacer { delay };
 
     while(img) {
-      auto now = std::chrono::steady_clock::now();
-
-      if(next_frame > now) {
-        std::this_thread::sleep_for((next_frame - now) / 3 * 2);
-      }
-      while(next_frame > now) {
-        std::this_thread::sleep_for(1ns);
-        now = std::chrono::steady_clock::now();
-      }
-      next_frame = now + delay;
+      pacer.wait();
 
       auto status = snapshot(img.get(), 1000ms, *cursor);
       switch(status) {
@@ -498,6 +794,29 @@ struct x11_attr_t : public display_t {
       BOOST_LOG(warning) << "X dimensions changed in non-SHM mode, request reinit"sv;
       return capture_e::reinit;
     }
+
+    xcursor_t overlay;
+    if(cursor) {
+      overlay.reset(x11::fix::GetCursorImage(xdisplay.get()));
+      if(!overlay) {
+        BOOST_LOG(error) << "Couldn't get cursor from XFixesGetCursorImage"sv;
+      }
+    }
+
+    if(!damage.update(overlay.get())) {
+      img_out_base->unchanged = true;
+
+      return capture_e::ok;
+    }
+
+    readback(img_out_base, overlay.get());
+
+    damage.apply(*img_out_base);
+
+    return capture_e::ok;
+  }
+
+  void readback(img_t *img_out_base, XFixesCursorImage *overlay) {
     XImage *img { x11::GetImage(xdisplay.get(), xwindow, offset_x, offset_y, width, height, AllPlanes, ZPixmap) };
 
     auto img_out         = (x11_img_t *)img_out_base;
@@ -508,11 +827,9 @@ struct x11_attr_t : public display_t {
     img_out->pixel_pitch = img->bits_per_pixel / 8;
     img_out->img.reset(img);
 
-    if(cursor) {
-      blend_cursor(xdisplay.get(), *img_out_base, offset_x, offset_y);
+    if(overlay) {
+      blend_cursor(overlay, *img_out_base, offset_x, offset_y, 1.0f);
     }
-
-    return capture_e::ok;
   }
 
   std::shared_ptr<img_t> alloc_img() override {
@@ -534,7 +851,10 @@ struct x11_attr_t : public display_t {
   }
 
   int dummy_img(img_t *img) override {
-    snapshot(img, 0s, true);
+    // Leave the damage tracking to the capture thread
+    xcursor_t overlay { x11::fix::GetCursorImage(xdisplay.get()) };
+    readback(img, overlay.get());
+
     return 0;
   }
 };
@@ -561,25 +881,88 @@ struct shm_attr_t : public x11_attr_t {
     refresh_task_id = task_pool.pushDelayed(&shm_attr_t::delayed_refresh, 2s, this).task_id;
   }
 
+  // The monitor, and the pixmap XRender scales it down into before it's read back
+  Picture root_picture {};
+  Pixmap scaled_pixmap {};
+  Picture scaled_picture {};
+
   ~shm_attr_t() override {
     while(!task_pool.cancel(refresh_task_id))
       ;
+
+    free_scaled();
+  }
+
+  bool scale_to(int width, int height) override {
+    if(x11::render::init()) {
+      BOOST_LOG(debug) << "XRender not available, images are read back at the size of the display"sv;
+      return false;
+    }
+
+    if(!fit(width, height)) {
+      return false;
+    }
+
+    free_scaled();
+
+    // The images of the previous size are left behind, the first one of the new size must be complete
+    damage.invalidate();
+
+    auto [out_width, out_height] = img_size();
+    if(out_width == this->width && out_height == this->height) {
+      return true;
+    }
+
+    auto dpy    = shm_xdisplay.get();
+    auto screen = DefaultScreen(dpy);
+    auto format = x11::render::FindVisualFormat(dpy, DefaultVisual(dpy, screen));
+
+    XRenderPictureAttributes attributes {};
+    attributes.subwindow_mode = IncludeInferiors;
+
+    root_picture   = x11::render::CreatePicture(dpy, DefaultRootWindow(dpy), format, CPSubwindowMode, &attributes);
+    scaled_pixmap  = x11::CreatePixmap(dpy, DefaultRootWindow(dpy), out_width, out_height, DefaultDepth(dpy, screen));
+    scaled_picture = x11::render::CreatePicture(dpy, scaled_pixmap, format, 0, nullptr);
+
+    // Maps the pixels of the pixmap onto the monitor
+    XTransform transform { {
+      { XDoubleToFixed((double)this->width / out_width), 0, XDoubleToFixed(offset_x) },
+      { 0, XDoubleToFixed((double)this->height / out_height), XDoubleToFixed(offset_y) },
+      { 0, 0, XDoubleToFixed(1) },
+    } };
+
+    x11::render::SetPictureTransform(dpy, root_picture, &transform);
+    x11::render::SetPictureFilter(dpy, root_picture, FilterBilinear, nullptr, 0);
+
+    BOOST_LOG(info) << "Scaling "sv << this->width << 'x' << this->height << " down to "sv << out_width << 'x' << out_height << " before reading it back"sv;
+
+    return true;
+  }
+
+  void free_scaled() {
+    auto dpy = shm_xdisplay.get();
+
+    if(scaled_picture) {
+      x11::render::FreePicture(dpy, scaled_picture);
+      scaled_picture = 0;
+    }
+
+    if(scaled_pixmap) {
+      x11::FreePixmap(dpy, scaled_pixmap);
+      scaled_pixmap = 0;
+    }
+
+    if(root_picture) {
+      x11::render::FreePicture(dpy, root_picture);
+      root_picture = 0;
+    }
   }
 
   capture_e capture(snapshot_cb_t &&snapshot_cb, std::shared_ptr<img_t> img, bool *cursor) override {
-    auto next_frame = std::chrono::steady_clock::now();
+    frame_pacer_t pacer { delay };
 
     while(img) {
-      auto now = std::chrono::steady_clock::now();
-
-      if(next_frame > now) {
-        std::this_thread::sleep_for((next_frame - now) / 3 * 2);
-      }
-      while(next_frame > now) {
-        std::this_thread::sleep_for(1ns);
-        now = std::chrono::steady_clock::now();
-      }
-      next_frame = now + delay;
+      pacer.wait();
 
       auto status = snapshot(img.get(), 1000ms, *cursor);
       switch(status) {
@@ -608,7 +991,42 @@ struct shm_attr_t : public x11_attr_t {
       return capture_e::reinit;
     }
     else {
-      auto img_cookie = xcb::shm_get_image_unchecked(xcb.get(), display->root, offset_x, offset_y, width, height, ~0, XCB_IMAGE_FORMAT_Z_PIXMAP, seg, 0);
+      xcursor_t overlay;
+      if(cursor) {
+        overlay.reset(x11::fix::GetCursorImage(shm_xdisplay.get()));
+        if(!overlay) {
+          BOOST_LOG(error) << "Couldn't get cursor from XFixesGetCursorImage"sv;
+        }
+      }
+
+      // An image allocated before the size changed, the damage is left for the next image of the right size
+      auto [out_width, out_height] = img_size();
+      if(img->width != out_width || img->height != out_height || (!scaled_picture && (out_width != width || out_height != height))) {
+        img->unchanged = true;
+
+        return capture_e::ok;
+      }
+
+      if(!damage.update(overlay.get())) {
+        img->unchanged = true;
+
+        return capture_e::ok;
+      }
+
+      xcb_drawable_t drawable = display->root;
+      int x = offset_x, y = offset_y;
+
+      if(img->width != width || img->height != height) {
+        x11::render::Composite(shm_xdisplay.get(), PictOpSrc, root_picture, None, scaled_picture, 0, 0, 0, 0, 0, 0, img->width, img->height);
+
+        // The pixmap is read on the xcb connection, the scaling must be done by then
+        x11::Sync(shm_xdisplay.get(), False);
+
+        drawable = scaled_pixmap;
+        x = y = 0;
+      }
+
+      auto img_cookie = xcb::shm_get_image_unchecked(xcb.get(), drawable, x, y, img->width, img->height, ~0, XCB_IMAGE_FORMAT_Z_PIXMAP, seg, 0);
 
       xcb_img_t img_reply { xcb::shm_get_image_reply(xcb.get(), img_cookie, nullptr) };
       if(!img_reply) {
@@ -616,23 +1034,27 @@ struct shm_attr_t : public x11_attr_t {
         return capture_e::reinit;
       }
 
-      std::copy_n((std::uint8_t *)data.data, frame_size(), img->data);
+      std::copy_n((std::uint8_t *)data.data, img->height * img->row_pitch, img->data);
 
-      if(cursor) {
-        blend_cursor(shm_xdisplay.get(), *img, offset_x, offset_y);
+      if(overlay) {
+        blend_cursor(overlay.get(), *img, offset_x, offset_y, (float)img->width / width);
       }
 
+      damage.apply(*img);
+
       return capture_e::ok;
     }
   }
 
   std::shared_ptr<img_t> alloc_img() override {
+    auto [out_width, out_height] = img_size();
+
     auto img         = std::make_shared<shm_img_t>();
-    img->width       = width;
-    img->height      = height;
+    img->width       = out_width;
+    img->height      = out_height;
     img->pixel_pitch = 4;
-    img->row_pitch   = img->pixel_pitch * width;
-    img->data        = new std::uint8_t[height * img->row_pitch];
+    img->row_pitch   = img->pixel_pitch * out_width;
+    img->data        = new std::uint8_t[out_height * img->row_pitch];
 
     return img;
   }
@@ -818,8 +1240,8 @@ void cursor_t::capture(egl::cursor_t &img) {
   img.serial      = xcursor->cursor_serial;
 }
 
-void cursor_t::blend(img_t &img, int offsetX, int offsetY) {
-  blend_cursor((xdisplay_t::pointer)ctx.get(), img, offsetX, offsetY);
+void cursor_t::blend(img_t &img, int offsetX, int offsetY, float scale) {
+  blend_cursor((xdisplay_t::pointer)ctx.get(), img, offsetX, offsetY, scale);
 }
 
 xdisplay_t make_display() {
@@ -34,8 +34,9 @@ public:
    * 
    * img <-- destination image
    * offsetX, offsetY <--- Top left corner of the virtual screen
+   * scale <--- The size of img relative to the captured area
    */
-  void blend(img_t &img, int offsetX, int offsetY);
+  void blend(img_t &img, int offsetX, int offsetY, float scale);
 
   cursor_ctx_t ctx;
 };
@@ -50,7 +51,7 @@ public:
   static std::optional<cursor_t> make() { return std::nullopt; }
 
   void capture(egl::cursor_t &) {}
-  void blend(img_t &, int, int) {}
+  void blend(img_t &, int, int, float) {}
 };
 
 xdisplay_t make_display() { return nullptr; }
@@ -0,0 +1,155 @@
+#ifndef SUNSHINE_PLATFORM_TILE_HASH_H
+#define SUNSHINE_PLATFORM_TILE_HASH_H
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "common.h"
+
+namespace platf {
+/**
+ * Detects changes between consecutive captured images, for backends without damage information.
+ *
+ * The image is split in tiles, each tile is reduced to a 64 bit hash.
+ * The inner loop works on eight independent 32 bit lanes, which the compiler turns into SIMD multiplies.
+ * This is not a cryptographic hash, it only needs to notice the screen changing.
+ */
+class tile_hash_t {
+public:
+  static constexpr int TILE_WIDTH  = 64;
+  static constexpr int TILE_HEIGHT = 64;
+
+  /**
+   * Hash img and compare it with the hashes of the previous call.
+   * img.damage is set to the tiles that differ.
+   * @return true if any tile differs from the previous image, or if the dimensions changed
+   */
+  bool update(img_t &img) {
+    auto tiles_x = (img.width + TILE_WIDTH - 1) / TILE_WIDTH;
+    auto tiles_y = (img.height + TILE_HEIGHT - 1) / TILE_HEIGHT;
+
+    img.damage.clear();
+
+    bool changed = false;
+    bool resized = false;
+    if(img.width != _width || img.height != _height) {
+      _width  = img.width;
+      _height = img.height;
+
+      _tiles.assign(tiles_x * tiles_y, 0);
+      changed = resized = true;
+    }
+
+    _lanes.resize(tiles_x);
+
+    for(int ty = 0; ty < tiles_y; ++ty) {
+      for(auto &lanes : _lanes) {
+        lanes.fill(SEED);
+      }
+
+      auto y_end = std::min(img.height, (ty + 1) * TILE_HEIGHT);
+      for(int y = ty * TILE_HEIGHT; y < y_end; ++y) {
+        auto row = img.data + y * img.row_pitch;
+
+        for(int tx = 0; tx < tiles_x; ++tx) {
+          auto x_end = std::min(img.width, (tx + 1) * TILE_WIDTH);
+
+          mix(_lanes[tx], row + tx * TILE_WIDTH * img.pixel_pitch, (x_end - tx * TILE_WIDTH) * img.pixel_pitch);
+        }
+      }
+
+      for(int tx = 0; tx < tiles_x; ++tx) {
+        auto hash = fold(_lanes[tx]);
+
+        auto &tile = _tiles[ty * tiles_x + tx];
+        if(tile == hash) {
+          continue;
+        }
+
+        tile    = hash;
+        changed = true;
+
+        if(resized) {
+          continue;
+        }
+
+        rect_t rect {
+          tx * TILE_WIDTH,
+          ty * TILE_HEIGHT,
+          std::min(TILE_WIDTH, img.width - tx * TILE_WIDTH),
+          std::min(TILE_HEIGHT, img.height - ty * TILE_HEIGHT),
+        };
+
+        // Merge with the changed tile to the left
+        auto &damage = img.damage;
+        if(!damage.empty() && damage.back().y == rect.y && damage.back().x + damage.back().width == rect.x) {
+          damage.back().width += rect.width;
+        }
+        else {
+          damage.emplace_back(rect);
+        }
+      }
+    }
+
+    return changed;
+  }
+
+  /**
+   * The next call to update() will report a change
+   */
+  void reset() {
+    _width  = 0;
+    _height = 0;
+  }
+
+private:
+  static constexpr std::size_t LANES = 8;
+  static constexpr std::uint32_t SEED  = 0x811C9DC5u;
+  static constexpr std::uint32_t PRIME = 0x9E3779B1u;
+
+  using lanes_t = std::array<std::uint32_t, LANES>;
+
+  static void mix(lanes_t &lanes, const std::uint8_t *data, int size) {
+    std::uint32_t words[LANES];
+
+    auto end = data + size / sizeof(words) * sizeof(words);
+    for(; data != end; data += sizeof(words)) {
+      std::memcpy(words, data, sizeof(words));
+
+      for(std::size_t x = 0; x < LANES; ++x) {
+        lanes[x] = (lanes[x] ^ words[x]) * PRIME;
+      }
+    }
+
+    // Pixels are 4 bytes, the remainder is a whole number of words
+    auto remaining = (size % sizeof(words)) / sizeof(std::uint32_t);
+    std::memcpy(words, data, remaining * sizeof(std::uint32_t));
+    for(std::size_t x = 0; x < remaining; ++x) {
+      lanes[x] = (lanes[x] ^ words[x]) * PRIME;
+    }
+  }
+
+  static std::uint64_t fold(const lanes_t &lanes) {
+    std::uint64_t hash = 0xCBF29CE484222325ull;
+    for(auto lane : lanes) {
+      hash = (hash ^ lane) * 0x100000001B3ull;
+      hash ^= hash >> 29;
+    }
+
+    return hash;
+  }
+
+  int _width {};
+  int _height {};
+
+  std::vector<std::uint64_t> _tiles;
+
+  // Running hashes of the current row of tiles
+  std::vector<lanes_t> _lanes;
+};
+} // namespace platf
+
+#endif
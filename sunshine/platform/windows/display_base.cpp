@@ -3,6 +3,7 @@
 //
 
 #include <codecvt>
+#include <sstream>
 
 #include "display.h"
 #include "misc.h"
@@ -510,4 +511,35 @@ std::vector<std::string> display_names(mem_type_e) {
   return display_names;
 }
 
+std::string gpu_fingerprint() {
+  std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>, wchar_t> converter;
+
+  dxgi::factory1_t factory;
+  auto status = CreateDXGIFactory1(IID_IDXGIFactory1, (void **)&factory);
+  if(FAILED(status)) {
+    BOOST_LOG(error) << "Failed to create DXGIFactory1 [0x"sv << util::hex(status).to_string_view() << ']' << std::endl;
+    return {};
+  }
+
+  std::stringstream ss;
+
+  dxgi::adapter_t adapter;
+  for(int x = 0; factory->EnumAdapters1(x, &adapter) != DXGI_ERROR_NOT_FOUND; ++x) {
+    DXGI_ADAPTER_DESC1 adapter_desc;
+    adapter->GetDesc1(&adapter_desc);
+
+    // The version of the user mode driver
+    LARGE_INTEGER driver_version {};
+    adapter->CheckInterfaceSupport(IID_IDXGIDevice, &driver_version);
+
+    ss
+      << converter.to_bytes(adapter_desc.Description) << ':'
+      << util::hex(adapter_desc.VendorId).to_string_view() << ':'
+      << util::hex(adapter_desc.DeviceId).to_string_view() << ':'
+      << driver_version.QuadPart << ';';
+  }
+
+  return ss.str();
+}
+
 } // namespace platf
@@ -153,7 +153,7 @@ void CALLBACK x360_notify(
     << "largeMotor: "sv << (int)largeMotor << std::endl
     << "smallMotor: "sv << (int)smallMotor;
 
-  task_pool.push(&vigem_t::rumble, (vigem_t *)userdata, target, smallMotor, largeMotor);
+  task_pool.post(&vigem_t::rumble, (vigem_t *)userdata, target, smallMotor, largeMotor);
 }
 
 void CALLBACK ds4_notify(
@@ -167,7 +167,7 @@ void CALLBACK ds4_notify(
     << "largeMotor: "sv << (int)largeMotor << std::endl
     << "smallMotor: "sv << (int)smallMotor;
 
-  task_pool.push(&vigem_t::rumble, (vigem_t *)userdata, target, smallMotor, largeMotor);
+  task_pool.post(&vigem_t::rumble, (vigem_t *)userdata, target, smallMotor, largeMotor);
 }
 
 input_t input() {
@@ -360,7 +360,7 @@ public:
 private:
   std::unordered_map<std::string_view, cmd_func_t> _map_cmd_cb;
 
-  util::sync_t<std::vector<std::shared_ptr<session_t>>> _session_slots;
+  util::sync_t<std::vector<std::shared_ptr<session_t>>> _session_slots { util::lock_site_t { "rtsp::session_slots" } };
 
   std::chrono::steady_clock::time_point raised_timeout;
   int _slot_count;
@@ -653,6 +653,25 @@ void cmd_announce(rtsp_server_t *server, tcp::socket &sock, msg_t &&req) {
     return;
   }
 
+  auto framerate = config.monitor.framerate;
+  // The reservation is released with the session if it doesn't start
+  if(!video::admit(config.monitor, config.reservation)) {
+    respond(sock, &option, 503, "Service Unavailable", req->sequenceNumber, {});
+    return;
+  }
+
+  // Tell the client the session was admitted at a lower framerate
+  OPTION_ITEM budget_option {};
+  std::string budget_value;
+  if(config.monitor.framerate != framerate) {
+    budget_value = "framerate=" + std::to_string(config.monitor.framerate);
+
+    budget_option.option  = const_cast<char *>("X-SS-CPU-Budget");
+    budget_option.content = budget_value.data();
+
+    option.next = &budget_option;
+  }
+
   auto session = session::alloc(config, launch_session->gcm_key, launch_session->iv);
 
   auto slot = server->accept(session);
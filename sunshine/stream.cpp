@@ -221,7 +221,7 @@ public:
   std::unordered_map<std::uint16_t, std::function<void(session_t *, const std::string_view &)>> _map_type_cb;
 
   // Mapping ip:port to session
-  util::sync_t<std::unordered_multimap<std::string, std::pair<std::uint16_t, session_t *>>> _map_addr_session;
+  util::sync_t<std::unordered_multimap<std::string, std::pair<std::uint16_t, session_t *>>> _map_addr_session { util::lock_site_t { "stream::map_addr_session" } };
 
   ENetAddress _addr;
   net::host_t _host;
@@ -245,7 +245,7 @@ struct broadcast_ctx_t {
   // It's possible two instances of Moonlight are behind a NAT.
   // From Sunshine's point of view, the ip addresses  are identical
   // We need some way to know what ports are already used for different streams
-  util::sync_t<std::vector<std::pair<std::string, std::uint16_t>>> audio_video_connections;
+  util::sync_t<std::vector<std::pair<std::string, std::uint16_t>>> audio_video_connections { util::lock_site_t { "stream::audio_video_connections" } };
 
   control_server_t control_server;
 };
@@ -1146,7 +1146,7 @@ int start_broadcast(broadcast_ctx_t &ctx) {
     return -1;
   }
 
-  ctx.message_queue_queue = std::make_shared<message_queue_queue_t::element_type>(30);
+  ctx.message_queue_queue = std::make_shared<message_queue_queue_t::element_type>(30, safe::overflow_e::clear, "stream::message_queue_queue");
 
   ctx.video_thread   = std::thread { videoBroadcastThread, std::ref(ctx.video_sock) };
   ctx.audio_thread   = std::thread { audioBroadcastThread, std::ref(ctx.audio_sock) };
@@ -1194,7 +1194,7 @@ void end_broadcast(broadcast_ctx_t &ctx) {
 int recv_ping(decltype(broadcast)::ptr_t ref, socket_e type, udp::endpoint &peer, std::chrono::milliseconds timeout) {
   auto constexpr ping = "PING"sv;
 
-  auto messages = std::make_shared<message_queue_t::element_type>(30);
+  auto messages = std::make_shared<message_queue_t::element_type>(30, safe::overflow_e::drop_oldest, "stream::ping_messages");
   ref->message_queue_queue->raise(type, peer.address(), messages);
 
   auto fg = util::fail_guard([&]() {
@@ -1274,7 +1274,7 @@ void videoThread(session_t *session) {
   }
 
   BOOST_LOG(debug) << "Start capturing Video"sv;
-  video::capture(session->mail, session->config.monitor, session);
+  video::capture(session->mail, session->config.monitor, std::move(session->config.reservation), session);
 }
 
 void audioThread(session_t *session) {
@@ -1400,7 +1400,7 @@ int start(session_t &session, const std::string &addr_string) {
 std::shared_ptr<session_t> alloc(config_t &config, crypto::aes_t &gcm_key, crypto::aes_t &iv) {
   auto session = std::make_shared<session_t>();
 
-  auto mail = std::make_shared<safe::mail_raw_t>();
+  auto mail = mail::make();
 
   session->shutdown_event = mail->event<bool>(mail::shutdown);
 
@@ -21,6 +21,9 @@ struct config_t {
   audio::config_t audio;
   video::config_t monitor;
 
+  // Set by video::admit(), the video thread takes it over
+  std::shared_ptr<video::reservation_t> reservation;
+
   int packetsize;
   int minRequiredFecPackets;
   int featureFlags;
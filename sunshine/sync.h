@@ -9,9 +9,11 @@
 #include <mutex>
 #include <utility>
 
+#include "lock_stats.h"
+
 namespace util {
 
-template<class T, class M = std::mutex>
+template<class T, class M = lock_stats::mutex_t>
 class sync_t {
 public:
   using value_t = T;
@@ -22,7 +24,14 @@ public:
   }
 
   template<class... Args>
-  sync_t(Args &&...args) : raw { std::forward<Args>(args)... } {}
+  sync_t(Args &&...args) : raw { std::forward<Args>(args)... } {
+    lock_stats::name(_lock, { "sync_t" });
+  }
+
+  template<class... Args>
+  sync_t(lock_site_t site, Args &&...args) : raw { std::forward<Args>(args)... } {
+    lock_stats::name(_lock, site);
+  }
 
   sync_t &operator=(sync_t &&other) noexcept {
     std::lock(_lock, other._lock);
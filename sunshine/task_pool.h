@@ -1,13 +1,20 @@
 #ifndef KITTY_TASK_POOL_H
 #define KITTY_TASK_POOL_H
 
+#include <array>
 #include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <deque>
 #include <functional>
 #include <future>
+#include <limits>
+#include <list>
 #include <mutex>
+#include <new>
 #include <optional>
 #include <type_traits>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -36,6 +43,111 @@ public:
   }
 };
 
+/*
+ * Type erased, move-only callable without a return value.
+ * Callables that fit inside SMALL_SIZE are stored inline, so pushing them doesn't allocate.
+ */
+class task_t {
+public:
+  static constexpr std::size_t SMALL_SIZE = 7 * sizeof(void *);
+
+  task_t() noexcept : _vtable { nullptr } {}
+
+  template<class Function, class = std::enable_if_t<!std::is_same_v<std::decay_t<Function>, task_t> && std::is_invocable_v<std::decay_t<Function> &>>>
+  task_t(Function &&f) : _vtable { &vtable_v<std::decay_t<Function>> } {
+    using func_t = std::decay_t<Function>;
+
+    if constexpr(is_small_v<func_t>) {
+      new(_buf) func_t(std::forward<Function>(f));
+    }
+    else {
+      *reinterpret_cast<func_t **>(_buf) = new func_t(std::forward<Function>(f));
+    }
+  }
+
+  task_t(task_t &&other) noexcept : _vtable { other._vtable } {
+    if(_vtable) {
+      _vtable->move(_buf, other._buf);
+      other._vtable = nullptr;
+    }
+  }
+
+  task_t &operator=(task_t &&other) noexcept {
+    if(this != &other) {
+      reset();
+
+      _vtable = other._vtable;
+      if(_vtable) {
+        _vtable->move(_buf, other._buf);
+        other._vtable = nullptr;
+      }
+    }
+
+    return *this;
+  }
+
+  ~task_t() {
+    reset();
+  }
+
+  void operator()() {
+    _vtable->run(_buf);
+  }
+
+  explicit operator bool() const {
+    return _vtable != nullptr;
+  }
+
+  void reset() {
+    if(_vtable) {
+      _vtable->destroy(_buf);
+      _vtable = nullptr;
+    }
+  }
+
+private:
+  struct vtable_t {
+    void (*run)(void *);
+
+    // Move-construct into dst, then destroy src
+    void (*move)(void *dst, void *src);
+    void (*destroy)(void *);
+  };
+
+  template<class T>
+  static constexpr bool is_small_v =
+    sizeof(T) <= SMALL_SIZE && alignof(T) <= alignof(std::max_align_t) && std::is_nothrow_move_constructible_v<T>;
+
+  template<class T>
+  static constexpr vtable_t make_vtable() {
+    if constexpr(is_small_v<T>) {
+      return {
+        [](void *buf) { (*std::launder(reinterpret_cast<T *>(buf)))(); },
+        [](void *dst, void *src) {
+          auto f = std::launder(reinterpret_cast<T *>(src));
+
+          new(dst) T(std::move(*f));
+          f->~T();
+        },
+        [](void *buf) { std::launder(reinterpret_cast<T *>(buf))->~T(); }
+      };
+    }
+    else {
+      return {
+        [](void *buf) { (**reinterpret_cast<T **>(buf))(); },
+        [](void *dst, void *src) { *reinterpret_cast<T **>(dst) = *reinterpret_cast<T **>(src); },
+        [](void *buf) { delete *reinterpret_cast<T **>(buf); }
+      };
+    }
+  }
+
+  template<class T>
+  static constexpr vtable_t vtable_v = make_vtable<T>();
+
+  alignas(std::max_align_t) std::uint8_t _buf[SMALL_SIZE];
+  const vtable_t *_vtable;
+};
+
 class TaskPool {
 public:
   typedef std::unique_ptr<_ImplBase> __task;
@@ -54,8 +166,279 @@ public:
   };
 
 protected:
-  std::deque<__task> _tasks;
-  std::vector<std::pair<__time_point, __task>> _timer_tasks;
+  /*
+   * Hierarchical timer wheel with a resolution of 1ms.
+   *
+   * Level 0 has a slot for each tick, every slot of a higher level spans all slots of the level below it.
+   * When the wheel turns past the end of a level, the next slot of the level above it is cascaded down.
+   * Scheduling, rescheduling and cancelling are O(1), expired timers are moved to a ready list.
+   */
+  class timer_wheel_t {
+  public:
+    typedef std::uint64_t tick_t;
+
+    static constexpr int LEVEL_BITS   = 6;
+    static constexpr int LEVELS       = 4;
+    static constexpr tick_t SLOTS     = 1 << LEVEL_BITS;
+    static constexpr tick_t SLOT_MASK = SLOTS - 1;
+    static constexpr tick_t MAX_TICKS = (tick_t)1 << (LEVEL_BITS * LEVELS);
+    static constexpr int READY        = LEVELS;
+    static constexpr auto RESOLUTION  = std::chrono::milliseconds(1);
+
+    struct entry_t {
+      __time_point time_point;
+      tick_t tick;
+      __task task;
+    };
+
+    typedef std::list<entry_t> slot_t;
+
+    // Locations don't point into the wheel directly, so the wheel can be moved
+    struct location_t {
+      int level;
+      tick_t pos;
+      slot_t::iterator it;
+    };
+
+    timer_wheel_t() : _epoch { std::chrono::steady_clock::now() }, _current { 0 }, _count {} {}
+
+    void schedule(__time_point time_point, __task &&task) {
+      slot_t tmp;
+      tmp.emplace_back(entry_t { time_point, to_tick(time_point), std::move(task) });
+
+      _insert(tmp, std::begin(tmp));
+    }
+
+    bool reschedule(task_id_t task_id, __time_point time_point) {
+      auto it = _locations.find(task_id);
+      if(it == std::end(_locations)) {
+        return false;
+      }
+
+      auto location = it->second;
+
+      location.it->time_point = time_point;
+      location.it->tick       = to_tick(time_point);
+
+      _erase(location);
+
+      slot_t tmp;
+      tmp.splice(std::begin(tmp), _slot(location), location.it);
+      _insert(tmp, std::begin(tmp));
+
+      return true;
+    }
+
+    std::optional<entry_t> remove(task_id_t task_id) {
+      auto it = _locations.find(task_id);
+      if(it == std::end(_locations)) {
+        return std::nullopt;
+      }
+
+      auto location = it->second;
+      _erase(location);
+
+      entry_t timer = std::move(*location.it);
+      _slot(location).erase(location.it);
+
+      return std::move(timer);
+    }
+
+    /**
+     * Turn the wheel up to 'now' and pop the oldest expired timer
+     */
+    std::optional<entry_t> pop(__time_point now) {
+      advance(now);
+
+      if(_ready.empty()) {
+        return std::nullopt;
+      }
+
+      return remove(_ready.front().task.get());
+    }
+
+    bool ready(__time_point now) {
+      advance(now);
+
+      return !_ready.empty();
+    }
+
+    /**
+     * The time point at which the wheel has to be turned for the earliest timer to expire
+     */
+    std::optional<__time_point> next() {
+      if(!_ready.empty()) {
+        return from_tick(_current);
+      }
+
+      auto min_tick = [](const slot_t &slot) {
+        return std::min_element(std::begin(slot), std::end(slot), [](const entry_t &l, const entry_t &r) {
+          return l.tick < r.tick;
+        })->tick;
+      };
+
+      // Below the top level, the first slot after the current one holds the earliest timer
+      for(int level = 0; level < LEVELS - 1; ++level) {
+        if(!_count[level]) {
+          continue;
+        }
+
+        auto pos = (_current >> (LEVEL_BITS * level)) & SLOT_MASK;
+        for(auto x = pos + 1; x < SLOTS; ++x) {
+          auto &slot = _wheel[level][x];
+
+          if(!slot.empty()) {
+            return from_tick(min_tick(slot));
+          }
+        }
+      }
+
+      // The top level holds timers beyond the range of the wheel, so every slot needs to be checked
+      if(!_count[LEVELS - 1]) {
+        return std::nullopt;
+      }
+
+      auto tick = std::numeric_limits<tick_t>::max();
+      for(auto &slot : _wheel[LEVELS - 1]) {
+        if(!slot.empty()) {
+          tick = std::min(tick, min_tick(slot));
+        }
+      }
+
+      return from_tick(tick);
+    }
+
+    void advance(__time_point now) {
+      if(now < _epoch) {
+        return;
+      }
+
+      auto target = (tick_t)((now - _epoch) / RESOLUTION);
+      while(_current < target) {
+        if(!(_count[0] | _count[1] | _count[2] | _count[3])) {
+          _current = target;
+
+          break;
+        }
+
+        // Skip ahead to the next point at which a level with timers needs attention
+        auto next = _current + 1;
+        for(int level = 0; level < LEVELS - 1 && !_count[level]; ++level) {
+          auto shift = LEVEL_BITS * (level + 1);
+
+          next = ((_current >> shift) + 1) << shift;
+        }
+
+        _current = std::min(next, target);
+        _turn();
+      }
+    }
+
+    tick_t to_tick(__time_point time_point) const {
+      if(time_point <= _epoch) {
+        return 0;
+      }
+
+      // Round up, a timer may never expire early
+      return (tick_t)((time_point - _epoch + RESOLUTION - std::chrono::nanoseconds(1)) / RESOLUTION);
+    }
+
+    __time_point from_tick(tick_t tick) const {
+      return _epoch + tick * RESOLUTION;
+    }
+
+  private:
+    void _turn() {
+      // Cascade the higher levels first, their timers may end up in the current slot of level 0
+      for(int level = LEVELS - 1; level > 0; --level) {
+        auto shift = LEVEL_BITS * level;
+        if(_current & (((tick_t)1 << shift) - 1)) {
+          continue;
+        }
+
+        auto &slot = _wheel[level][(_current >> shift) & SLOT_MASK];
+
+        slot_t tmp;
+        tmp.splice(std::begin(tmp), slot);
+        _count[level] -= tmp.size();
+
+        while(!tmp.empty()) {
+          _insert(tmp, std::begin(tmp));
+        }
+      }
+
+      auto &slot = _wheel[0][_current & SLOT_MASK];
+      for(auto &timer : slot) {
+        auto &location = _locations[timer.task.get()];
+
+        location.level = READY;
+        location.pos   = 0;
+      }
+
+      _count[0] -= slot.size();
+      _ready.splice(std::end(_ready), slot);
+    }
+
+    // Move the timer from 'from' into the slot it belongs to
+    void _insert(slot_t &from, slot_t::iterator it) {
+      auto tick = it->tick;
+
+      location_t location { READY, 0, it };
+
+      if(tick > _current) {
+        auto &level = location.level;
+
+        if(tick - _current >= MAX_TICKS) {
+          // Beyond the range of the wheel, it will be placed again when this slot is cascaded
+          level = LEVELS - 1;
+          tick  = _current;
+        }
+        else {
+          level = 0;
+          while(level < LEVELS - 1 && (tick >> (LEVEL_BITS * (level + 1))) != (_current >> (LEVEL_BITS * (level + 1)))) {
+            ++level;
+          }
+        }
+
+        location.pos = (tick >> (LEVEL_BITS * level)) & SLOT_MASK;
+        ++_count[level];
+      }
+
+      auto &slot = _slot(location);
+      slot.splice(std::end(slot), from, it);
+
+      _locations[it->task.get()] = location;
+    }
+
+    slot_t &_slot(const location_t &location) {
+      if(location.level == READY) {
+        return _ready;
+      }
+
+      return _wheel[location.level][location.pos];
+    }
+
+    void _erase(const location_t &location) {
+      if(location.level != READY) {
+        --_count[location.level];
+      }
+
+      _locations.erase(location.it->task.get());
+    }
+
+    __time_point _epoch;
+    tick_t _current;
+
+    std::array<std::array<slot_t, SLOTS>, LEVELS> _wheel;
+    std::array<std::size_t, LEVELS> _count;
+
+    slot_t _ready;
+
+    std::unordered_map<task_id_t, location_t> _locations;
+  };
+
+  std::deque<task_t> _tasks;
+  timer_wheel_t _timer_tasks;
   std::mutex _task_mutex;
 
 public:
@@ -73,34 +456,42 @@ public:
   auto push(Function &&newTask, Args &&...args) {
     static_assert(std::is_invocable_v<Function, Args &&...>, "arguments don't match the function");
 
-    using __return = std::invoke_result_t<Function, Args &&...>;
-    using task_t   = std::packaged_task<__return()>;
+    using __return   = std::invoke_result_t<Function, Args &&...>;
+    using packaged_t = std::packaged_task<__return()>;
 
     auto bind = [task = std::forward<Function>(newTask), tuple_args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
       return std::apply(task, std::move(tuple_args));
     };
 
-    task_t task(std::move(bind));
+    packaged_t task(std::move(bind));
 
     auto future = task.get_future();
 
     std::lock_guard<std::mutex> lg(_task_mutex);
-    _tasks.emplace_back(toRunnable(std::move(task)));
+    _tasks.emplace_back(std::move(task));
 
     return future;
   }
 
+  /**
+   * Like push(), without the overhead of a future
+   */
+  template<class Function, class... Args>
+  void post(Function &&newTask, Args &&...args) {
+    static_assert(std::is_invocable_v<Function, Args &&...>, "arguments don't match the function");
+
+    auto bind = [task = std::forward<Function>(newTask), tuple_args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+      std::apply(task, std::move(tuple_args));
+    };
+
+    std::lock_guard<std::mutex> lg(_task_mutex);
+    _tasks.emplace_back(std::move(bind));
+  }
+
   void pushDelayed(std::pair<__time_point, __task> &&task) {
     std::lock_guard lg(_task_mutex);
 
-    auto it = _timer_tasks.cbegin();
-    for(; it < _timer_tasks.cend(); ++it) {
-      if(std::get<0>(*it) < task.first) {
-        break;
-      }
-    }
-
-    _timer_tasks.emplace(it, task.first, std::move(task.second));
+    _timer_tasks.schedule(task.first, std::move(task.second));
   }
 
   /**
@@ -110,8 +501,8 @@ public:
   auto pushDelayed(Function &&newTask, std::chrono::duration<X, Y> duration, Args &&...args) {
     static_assert(std::is_invocable_v<Function, Args &&...>, "arguments don't match the function");
 
-    using __return = std::invoke_result_t<Function, Args &&...>;
-    using task_t   = std::packaged_task<__return()>;
+    using __return   = std::invoke_result_t<Function, Args &&...>;
+    using packaged_t = std::packaged_task<__return()>;
 
     __time_point time_point;
     if constexpr(std::is_floating_point_v<X>) {
@@ -125,7 +516,7 @@ public:
       return std::apply(task, std::move(tuple_args));
     };
 
-    task_t task(std::move(bind));
+    packaged_t task(std::move(bind));
 
     auto future   = task.get_future();
     auto runnable = toRunnable(std::move(task));
@@ -144,76 +535,37 @@ public:
   void delay(task_id_t task_id, std::chrono::duration<X, Y> duration) {
     std::lock_guard<std::mutex> lg(_task_mutex);
 
-    auto it = _timer_tasks.begin();
-    for(; it < _timer_tasks.cend(); ++it) {
-      const __task &task = std::get<1>(*it);
-
-      if(&*task == task_id) {
-        std::get<0>(*it) = std::chrono::steady_clock::now() + duration;
-
-        break;
-      }
-    }
-
-    if(it == _timer_tasks.cend()) {
-      return;
-    }
-
-    // smaller time goes to the back
-    auto prev = it - 1;
-    while(it > _timer_tasks.cbegin()) {
-      if(std::get<0>(*it) > std::get<0>(*prev)) {
-        std::swap(*it, *prev);
-      }
-
-      --prev;
-      --it;
-    }
+    _timer_tasks.reschedule(task_id, std::chrono::steady_clock::now() + duration);
   }
 
   bool cancel(task_id_t task_id) {
     std::lock_guard lg(_task_mutex);
 
-    auto it = _timer_tasks.begin();
-    for(; it < _timer_tasks.cend(); ++it) {
-      const __task &task = std::get<1>(*it);
-
-      if(&*task == task_id) {
-        _timer_tasks.erase(it);
-
-        return true;
-      }
-    }
-
-    return false;
+    return (bool)_timer_tasks.remove(task_id);
   }
 
   std::optional<std::pair<__time_point, __task>> pop(task_id_t task_id) {
     std::lock_guard lg(_task_mutex);
 
-    auto pos = std::find_if(std::begin(_timer_tasks), std::end(_timer_tasks), [&task_id](const auto &t) { return t.second.get() == task_id; });
-
-    if(pos == std::end(_timer_tasks)) {
+    auto timer = _timer_tasks.remove(task_id);
+    if(!timer) {
       return std::nullopt;
     }
 
-    return std::move(*pos);
+    return std::make_pair(timer->time_point, std::move(timer->task));
   }
 
-  std::optional<__task> pop() {
+  std::optional<task_t> pop() {
     std::lock_guard lg(_task_mutex);
 
     if(!_tasks.empty()) {
-      __task task = std::move(_tasks.front());
+      task_t task = std::move(_tasks.front());
       _tasks.pop_front();
       return std::move(task);
     }
 
-    if(!_timer_tasks.empty() && std::get<0>(_timer_tasks.back()) <= std::chrono::steady_clock::now()) {
-      __task task = std::move(std::get<1>(_timer_tasks.back()));
-      _timer_tasks.pop_back();
-
-      return std::move(task);
+    if(auto timer = _timer_tasks.pop(std::chrono::steady_clock::now())) {
+      return task_t { [task = std::move(timer->task)]() { task->run(); } };
     }
 
     return std::nullopt;
@@ -222,17 +574,13 @@ public:
   bool ready() {
     std::lock_guard<std::mutex> lg(_task_mutex);
 
-    return !_tasks.empty() || (!_timer_tasks.empty() && std::get<0>(_timer_tasks.back()) <= std::chrono::steady_clock::now());
+    return !_tasks.empty() || _timer_tasks.ready(std::chrono::steady_clock::now());
   }
 
   std::optional<__time_point> next() {
     std::lock_guard<std::mutex> lg(_task_mutex);
 
-    if(_timer_tasks.empty()) {
-      return std::nullopt;
-    }
-
-    return std::get<0>(_timer_tasks.back());
+    return _timer_tasks.next();
   }
 
 private:
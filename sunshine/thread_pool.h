@@ -2,32 +2,97 @@
 #define KITTY_THREAD_POOL_H
 
 #include "task_pool.h"
+#include <atomic>
 #include <thread>
 
 namespace util {
 /*
  * Allow threads to execute unhindered
  * while keeping full controll over the threads.
+ *
+ * Tasks pushed through the TaskPool interface (push, post, pushDelayed) form a serial lane:
+ * they run in order, one at a time, though not necessarily on the same thread.
+ * Tasks passed to spawn() or parallel_for() go into per-worker deques and may run concurrently.
+ * Idle workers steal from the back of the other workers' deques.
  */
 class ThreadPool : public TaskPool {
 public:
   typedef TaskPool::__task __task;
 
 private:
-  std::vector<std::thread> _thread;
+  struct worker_t {
+    ThreadPool *pool;
+    std::size_t index;
+
+    std::thread thread;
+
+    std::mutex lock;
+    std::deque<task_t> tasks;
+  };
+
+  struct parallel_t {
+    parallel_t(int count, void (*run)(void *, int), void *f) : next { 0 }, count { count }, finished { 0 }, run { run }, f { f } {}
+
+    void work() {
+      int done = 0;
+      for(int i = next++; i < count; i = next++) {
+        run(f, i);
+        ++done;
+      }
+
+      if(done) {
+        std::lock_guard lg(lock);
+
+        finished += done;
+        if(finished == count) {
+          cv.notify_all();
+        }
+      }
+    }
+
+    void wait() {
+      std::unique_lock ul(lock);
+
+      cv.wait(ul, [this]() { return finished == count; });
+    }
+
+    std::atomic<int> next;
+    int count;
+    int finished;
+
+    // 'f' is only dereferenced while an index is claimed, the caller of parallel_for() can't have returned yet
+    void (*run)(void *, int);
+    void *f;
+
+    std::mutex lock;
+    std::condition_variable cv;
+  };
+
+  std::vector<std::unique_ptr<worker_t>> _workers;
 
   std::condition_variable _cv;
   std::mutex _lock;
 
+  // A thread is executing a task from the serial lane
+  bool _serial_busy;
+
+  // Number of tasks in the worker deques
+  std::atomic<std::size_t> _stealable;
+
+  // Number of threads about to wait or waiting on _cv
+  std::atomic<int> _sleeping;
+
+  std::atomic<std::size_t> _next_worker;
+
   bool _continue;
 
+  static inline thread_local worker_t *_current {};
+
 public:
-  ThreadPool() : _continue { false } {}
+  ThreadPool() : _serial_busy { false }, _stealable { 0 }, _sleeping { 0 }, _next_worker { 0 }, _continue { false } {}
 
-  explicit ThreadPool(int threads) : _thread(threads), _continue { true } {
-    for(auto &t : _thread) {
-      t = std::thread(&ThreadPool::_main, this);
-    }
+  explicit ThreadPool(int threads) : ThreadPool() {
+    start(threads);
   }
 
   ~ThreadPool() noexcept {
@@ -46,29 +111,121 @@ public:
     return future;
   }
 
+  template<class Function, class... Args>
+  void post(Function &&newTask, Args &&...args) {
+    std::lock_guard lg(_lock);
+    TaskPool::post(std::forward<Function>(newTask), std::forward<Args>(args)...);
+
+    _cv.notify_one();
+  }
+
   void pushDelayed(std::pair<__time_point, __task> &&task) {
     std::lock_guard lg(_lock);
 
+    auto earliest = next();
     TaskPool::pushDelayed(std::move(task));
+
+    _notify_earliest(earliest);
   }
 
   template<class Function, class X, class Y, class... Args>
   auto pushDelayed(Function &&newTask, std::chrono::duration<X, Y> duration, Args &&...args) {
     std::lock_guard lg(_lock);
-    auto future = TaskPool::pushDelayed(std::forward<Function>(newTask), duration, std::forward<Args>(args)...);
 
-    // Update all timers for wait_until
-    _cv.notify_all();
+    auto earliest = next();
+    auto future   = TaskPool::pushDelayed(std::forward<Function>(newTask), duration, std::forward<Args>(args)...);
+
+    _notify_earliest(earliest);
     return future;
   }
 
+  template<class X, class Y>
+  void delay(task_id_t task_id, std::chrono::duration<X, Y> duration) {
+    std::lock_guard lg(_lock);
+
+    auto earliest = next();
+    TaskPool::delay(task_id, duration);
+
+    _notify_earliest(earliest);
+  }
+
+  /**
+   * Queue a task that may run concurrently with any other task in the pool.
+   * When called from one of the pool's threads, the task is queued on that thread's own deque.
+   *
+   * If the pool hasn't been started, the task is executed by the caller.
+   */
+  template<class Function, class... Args>
+  void spawn(Function &&newTask, Args &&...args) {
+    static_assert(std::is_invocable_v<Function, Args &&...>, "arguments don't match the function");
+
+    task_t runnable { [task = std::forward<Function>(newTask), tuple_args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+      std::apply(task, std::move(tuple_args));
+    } };
+
+    if(_workers.empty()) {
+      runnable();
+      return;
+    }
+
+    auto worker = _current && _current->pool == this ? _current : _workers[_next_worker++ % _workers.size()].get();
+    {
+      std::lock_guard lg(worker->lock);
+      worker->tasks.emplace_back(std::move(runnable));
+    }
+
+    // Either a thread about to sleep sees the new task, or we see that thread
+    ++_stealable;
+    if(_sleeping > 0) {
+      std::lock_guard lg(_lock);
+      _cv.notify_one();
+    }
+  }
+
+  /**
+   * Call f(i) for every i in [0, count)
+   * The calling thread takes part in the work and returns once every call has finished.
+   */
+  template<class Function>
+  void parallel_for(int count, Function &&f) {
+    static_assert(std::is_invocable_v<Function, int>, "f must be callable with an index");
+
+    if(count <= 0) {
+      return;
+    }
+
+    auto state = std::make_shared<parallel_t>(
+      count, [](void *f, int i) { (*(std::remove_reference_t<Function> *)f)(i); }, (void *)&f);
+
+    auto helpers = std::min<int>(count - 1, _workers.size());
+    for(int x = 0; x < helpers; ++x) {
+      spawn([state]() { state->work(); });
+    }
+
+    state->work();
+    state->wait();
+  }
+
+  /**
+   * @return the number of threads in the pool
+   */
+  int size() const {
+    return (int)_workers.size();
+  }
+
   void start(int threads) {
     _continue = true;
 
-    _thread.resize(threads);
+    _workers.resize(threads);
+    for(int x = 0; x < threads; ++x) {
+      _workers[x]        = std::make_unique<worker_t>();
+      _workers[x]->pool  = this;
+      _workers[x]->index = x;
+    }
 
-    for(auto &t : _thread) {
-      t = std::thread(&ThreadPool::_main, this);
+    // All workers must exist before any of them starts stealing
+    for(auto &worker : _workers) {
+      worker->thread = std::thread(&ThreadPool::_main, this, worker.get());
     }
   }
 
@@ -80,41 +237,147 @@ public:
   }
 
   void join() {
-    for(auto &t : _thread) {
-      t.join();
+    for(auto &worker : _workers) {
+      worker->thread.join();
+    }
+  }
+
+private:
+  /**
+   * Threads sleep until the earliest deadline,
+   * only one of them needs to wake up when a new task has become the earliest
+   */
+  void _notify_earliest(const std::optional<__time_point> &earliest) {
+    if(next() != earliest) {
+      _cv.notify_one();
+    }
+  }
+
+  /**
+   * Execute the next task from the serial lane, unless another thread is busy with it.
+   * @return true if a task was executed
+   */
+  bool _run_serial() {
+    std::optional<task_t> task;
+    {
+      std::lock_guard lg(_lock);
+      if(_serial_busy) {
+        return false;
+      }
+
+      task = pop();
+      if(!task) {
+        return false;
+      }
+
+      _serial_busy = true;
     }
+
+    (*task)();
+
+    std::lock_guard lg(_lock);
+    _serial_busy = false;
+
+    // Threads that went to sleep while the lane was busy don't track the timers
+    if(next()) {
+      _cv.notify_one();
+    }
+
+    return true;
+  }
+
+  /**
+   * Take the oldest task of our own deque, otherwise the newest task of another worker.
+   */
+  task_t _pop_stealable(worker_t *self) {
+    if(_stealable == 0) {
+      return {};
+    }
+
+    auto take = [this](worker_t *worker, bool front) -> task_t {
+      std::lock_guard lg(worker->lock);
+      if(worker->tasks.empty()) {
+        return {};
+      }
+
+      task_t task;
+      if(front) {
+        task = std::move(worker->tasks.front());
+        worker->tasks.pop_front();
+      }
+      else {
+        task = std::move(worker->tasks.back());
+        worker->tasks.pop_back();
+      }
+
+      --_stealable;
+      return task;
+    };
+
+    if(auto task = take(self, true)) {
+      return task;
+    }
+
+    for(std::size_t x = 1; x < _workers.size(); ++x) {
+      if(auto task = take(_workers[(self->index + x) % _workers.size()].get(), false)) {
+        return task;
+      }
+    }
+
+    return {};
   }
 
 public:
-  void _main() {
+  void _main(worker_t *self) {
+    _current = self;
+
     while(_continue) {
-      if(auto task = this->pop()) {
-        (*task)->run();
+      if(_run_serial()) {
+        continue;
       }
-      else {
-        std::unique_lock uniq_lock(_lock);
 
-        if(ready()) {
-          continue;
-        }
+      if(auto task = _pop_stealable(self)) {
+        task();
+        continue;
+      }
 
-        if(!_continue) {
-          break;
-        }
+      std::unique_lock uniq_lock(_lock);
 
-        if(auto tp = next()) {
-          _cv.wait_until(uniq_lock, *tp);
-        }
-        else {
-          _cv.wait(uniq_lock);
-        }
+      ++_sleeping;
+      auto fg = util::fail_guard([this]() { --_sleeping; });
+
+      if(!_continue) {
+        break;
+      }
+
+      if(_stealable > 0 || (!_serial_busy && ready())) {
+        continue;
+      }
+
+      std::optional<__time_point> tp;
+      if(!_serial_busy && (tp = next())) {
+        _cv.wait_until(uniq_lock, *tp);
+      }
+      else {
+        _cv.wait(uniq_lock);
       }
     }
 
     // Execute remaining tasks
-    while(auto task = this->pop()) {
-      (*task)->run();
+    while(true) {
+      if(_run_serial()) {
+        continue;
+      }
+
+      if(auto task = _pop_stealable(self)) {
+        task();
+        continue;
+      }
+
+      break;
     }
+
+    _current = nullptr;
   }
 };
 } // namespace util
@@ -6,12 +6,14 @@
 #define SUNSHINE_THREAD_SAFE_H
 
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <functional>
-#include <map>
 #include <mutex>
+#include <optional>
 #include <vector>
 
+#include "lock_stats.h"
 #include "utility.h"
 
 namespace safe {
@@ -20,6 +22,14 @@ class event_t {
 public:
   using status_t = util::optional_t<T>;
 
+  event_t() {
+    util::lock_stats::name(_lock, { "event_t" });
+  }
+
+  explicit event_t(util::lock_site_t site) {
+    util::lock_stats::name(_lock, site);
+  }
+
   template<class... Args>
   void raise(Args &&...args) {
     std::lock_guard lg { _lock };
@@ -125,8 +135,8 @@ private:
   bool _continue { true };
   status_t _status { util::false_v<status_t> };
 
-  std::condition_variable _cv;
-  std::mutex _lock;
+  util::lock_stats::condition_variable_t _cv;
+  util::lock_stats::mutex_t _lock;
 };
 
 template<class T>
@@ -216,32 +226,92 @@ alarm_t<T> make_alarm() {
   return std::make_shared<alarm_raw_t<T>>();
 }
 
+enum class overflow_e {
+  drop_oldest, // Discard the element at the front of the queue
+  drop_newest, // Discard the element that is being raised
+  block,       // Wait until a consumer has made room
+  clear,       // Discard everything in the queue
+};
+
+#ifdef SUNSHINE_QUEUE_STATS
+struct queue_stats_t {
+  std::uint64_t raised;
+  std::uint64_t popped;
+  std::uint64_t dropped;
+
+  // Time spent by consumers waiting for an element, or producers waiting for room
+  std::chrono::nanoseconds pop_wait;
+  std::chrono::nanoseconds raise_wait;
+
+  // Sum of the occupancy observed at each raise, divide by raised for the average
+  std::uint64_t occupancy_sum;
+  std::uint32_t occupancy_max;
+};
+#endif
+
+/**
+ * A fixed capacity ring of elements.
+ * When the ring is full, the overflow policy decides what happens to newly raised elements.
+ */
 template<class T>
 class queue_t {
 public:
   using status_t = util::optional_t<T>;
 
-  queue_t(std::uint32_t max_elements = 32) : _max_elements { max_elements } {}
+  queue_t(std::uint32_t max_elements = 32, overflow_e overflow = overflow_e::clear, util::lock_site_t site = { "queue_t" })
+      : _max_elements { max_elements }, _overflow { overflow }, _ring(max_elements) {
+    util::lock_stats::name(_lock, site);
+  }
 
   template<class... Args>
   void raise(Args &&...args) {
-    std::lock_guard ul { _lock };
+    std::unique_lock ul { _lock };
 
     if(!_continue) {
       return;
     }
 
-    if(_queue.size() == _max_elements) {
-      _queue.clear();
+    if(_size == _max_elements) {
+      switch(_overflow) {
+      case overflow_e::drop_oldest:
+        _pop_front();
+        _stat_dropped(1);
+        break;
+      case overflow_e::drop_newest:
+        _stat_dropped(1);
+        return;
+      case overflow_e::block: {
+        auto wait_begin = _stat_begin_wait();
+
+        while(_size == _max_elements) {
+          _cv_room.wait(ul);
+
+          if(!_continue) {
+            return;
+          }
+        }
+
+        _stat_end_raise_wait(wait_begin);
+      } break;
+      case overflow_e::clear:
+        _stat_dropped(_size);
+        while(_size) {
+          _pop_front();
+        }
+        break;
+      }
     }
 
-    _queue.emplace_back(std::forward<Args>(args)...);
+    _ring[(_begin + _size) % _max_elements].emplace(std::forward<Args>(args)...);
+    ++_size;
 
-    _cv.notify_all();
+    _stat_raised();
+
+    _cv.notify_one();
   }
 
   bool peek() {
-    return _continue && !_queue.empty();
+    return _continue && _size;
   }
 
   template<class Rep, class Period>
@@ -252,16 +322,15 @@ public:
       return util::false_v<status_t>;
     }
 
-    while(_queue.empty()) {
+    auto wait_begin = _stat_begin_wait();
+    while(!_size) {
       if(!_continue || _cv.wait_for(ul, delay) == std::cv_status::timeout) {
         return util::false_v<status_t>;
       }
     }
+    _stat_end_pop_wait(wait_begin);
 
-    auto val = std::move(_queue.front());
-    _queue.erase(std::begin(_queue));
-
-    return val;
+    return _pop_front();
   }
 
   status_t pop() {
@@ -271,22 +340,33 @@ public:
       return util::false_v<status_t>;
     }
 
-    while(_queue.empty()) {
+    auto wait_begin = _stat_begin_wait();
+    while(!_size) {
       _cv.wait(ul);
 
       if(!_continue) {
         return util::false_v<status_t>;
       }
     }
+    _stat_end_pop_wait(wait_begin);
 
-    auto val = std::move(_queue.front());
-    _queue.erase(std::begin(_queue));
-
-    return val;
+    return _pop_front();
   }
 
-  std::vector<T> &unsafe() {
-    return _queue;
+  /**
+   * Remove all elements from the queue, even if the queue has been stopped
+   */
+  std::vector<T> drain() {
+    std::lock_guard lg { _lock };
+
+    std::vector<T> elements;
+    elements.reserve(_size);
+
+    while(_size) {
+      elements.emplace_back(_pop_front());
+    }
+
+    return elements;
   }
 
   void stop() {
@@ -295,20 +375,93 @@ public:
     _continue = false;
 
     _cv.notify_all();
+    _cv_room.notify_all();
   }
 
   [[nodiscard]] bool running() const {
     return _continue;
   }
 
+#ifdef SUNSHINE_QUEUE_STATS
+  queue_stats_t stats() {
+    std::lock_guard lg { _lock };
+
+    return _stats;
+  }
+#endif
+
 private:
+  // Requires _lock to be held and _size to be non-zero
+  T _pop_front() {
+    auto &slot = _ring[_begin];
+
+    T val = std::move(*slot);
+    slot.reset();
+
+    _begin = (_begin + 1) % _max_elements;
+    --_size;
+
+    _cv_room.notify_one();
+
+    return val;
+  }
+
+#ifdef SUNSHINE_QUEUE_STATS
+  // Each waiter keeps its own start, several threads may wait at once
+  using wait_begin_t = std::chrono::steady_clock::time_point;
+
+  wait_begin_t _stat_begin_wait() {
+    return std::chrono::steady_clock::now();
+  }
+
+  void _stat_end_pop_wait(wait_begin_t begin) {
+    _stats.pop_wait += std::chrono::steady_clock::now() - begin;
+    ++_stats.popped;
+  }
+
+  void _stat_end_raise_wait(wait_begin_t begin) {
+    _stats.raise_wait += std::chrono::steady_clock::now() - begin;
+  }
+
+  void _stat_raised() {
+    ++_stats.raised;
+    _stats.occupancy_sum += _size;
+    _stats.occupancy_max = std::max(_stats.occupancy_max, _size);
+  }
+
+  void _stat_dropped(std::uint32_t count) {
+    _stats.dropped += count;
+  }
+
+  queue_stats_t _stats {};
+#else
+  struct wait_begin_t {};
+
+  wait_begin_t _stat_begin_wait() {
+    return {};
+  }
+
+  void _stat_end_pop_wait(wait_begin_t) {}
+  void _stat_end_raise_wait(wait_begin_t) {}
+  void _stat_raised() {}
+  void _stat_dropped(std::uint32_t) {}
+#endif
+
   bool _continue { true };
   std::uint32_t _max_elements;
+  overflow_e _overflow;
 
-  std::mutex _lock;
-  std::condition_variable _cv;
+  util::lock_stats::mutex_t _lock;
+
+  // Signaled when an element is raised
+  util::lock_stats::condition_variable_t _cv;
+
+  // Signaled when an element is popped, only waited on with overflow_e::block
+  util::lock_stats::condition_variable_t _cv_room;
 
-  std::vector<T> _queue;
+  std::vector<std::optional<T>> _ring;
+  std::uint32_t _begin {};
+  std::uint32_t _size {};
 };
 
 template<class T>
@@ -424,28 +577,51 @@ auto make_shared(F_Construct &&fc, F_Destruct &&fd) {
 
 using signal_t = event_t<bool>;
 
+/**
+ * Keys for the mailbox, the key decides both the slot and the type of the post stored in it.
+ * Keys are meant to be declared as constexpr objects, with an id unique to the mailbox.
+ */
+template<class T>
+struct event_key_t {
+  using value_type = T;
+
+  std::size_t id;
+
+  // Names the lock of the post
+  const char *name;
+};
+
+template<class T>
+struct queue_key_t {
+  using value_type = T;
+
+  std::size_t id;
+
+  std::uint32_t max_elements;
+  overflow_e overflow;
+
+  // Names the lock of the post
+  const char *name;
+};
+
 class mail_raw_t;
 using mail_t = std::shared_ptr<mail_raw_t>;
 
-void cleanup(mail_raw_t *);
+void cleanup(mail_raw_t *, std::size_t id);
 template<class T>
 class post_t : public T {
 public:
   template<class... Args>
-  post_t(mail_t mail, Args &&...args) : T(std::forward<Args>(args)...), mail { std::move(mail) } {}
+  post_t(mail_t mail, std::size_t id, Args &&...args) : T(std::forward<Args>(args)...), mail { std::move(mail) }, id { id } {}
 
   mail_t mail;
+  std::size_t id;
 
   ~post_t() {
-    cleanup(mail.get());
+    cleanup(mail.get(), id);
   }
 };
 
-template<class T>
-inline auto lock(const std::weak_ptr<void> &wp) {
-  return std::reinterpret_pointer_cast<typename T::element_type>(wp.lock());
-}
-
 class mail_raw_t : public std::enable_shared_from_this<mail_raw_t> {
 public:
   template<class T>
@@ -454,57 +630,60 @@ public:
   template<class T>
   using queue_t = std::shared_ptr<post_t<queue_t<T>>>;
 
-  template<class T>
-  event_t<T> event(const std::string_view &id) {
-    std::lock_guard lg { mutex };
+  explicit mail_raw_t(std::size_t slots) : slots(slots) {}
 
-    auto it = id_to_post.find(id);
-    if(it != std::end(id_to_post)) {
-      return lock<event_t<T>>(it->second);
-    }
+  /**
+   * T is optional, when given it must match the type of the key
+   */
+  template<class T = void, class V>
+  event_t<V> event(const event_key_t<V> &key) {
+    static_assert(std::is_void_v<T> || std::is_same_v<T, V>, "type doesn't match the type of the mail key");
 
-    auto post = std::make_shared<typename event_t<T>::element_type>(shared_from_this());
-    id_to_post.emplace(std::pair<std::string, std::weak_ptr<void>> { std::string { id }, post });
+    return post<typename event_t<V>::element_type>(key.id, util::lock_site_t { key.name });
+  }
 
-    return post;
+  /**
+   * T is optional, when given it must match the type of the key
+   */
+  template<class T = void, class V>
+  queue_t<V> queue(const queue_key_t<V> &key) {
+    static_assert(std::is_void_v<T> || std::is_same_v<T, V>, "type doesn't match the type of the mail key");
+
+    return post<typename queue_t<V>::element_type>(key.id, key.max_elements, key.overflow, util::lock_site_t { key.name });
   }
 
-  template<class T>
-  queue_t<T> queue(const std::string_view &id) {
+  void cleanup(std::size_t id) {
     std::lock_guard lg { mutex };
 
-    auto it = id_to_post.find(id);
-    if(it != std::end(id_to_post)) {
-      return lock<queue_t<T>>(it->second);
+    // The slot may already contain a new post
+    if(slots[id].expired()) {
+      slots[id].reset();
     }
-
-    auto post = std::make_shared<typename queue_t<T>::element_type>(shared_from_this(), 32);
-    id_to_post.emplace(std::pair<std::string, std::weak_ptr<void>> { std::string { id }, post });
-
-    return post;
   }
 
-  void cleanup() {
-    std::lock_guard lg { mutex };
+  std::mutex mutex;
 
-    for(auto it = std::begin(id_to_post); it != std::end(id_to_post); ++it) {
-      auto &weak = it->second;
+  std::vector<std::weak_ptr<void>> slots;
 
-      if(weak.expired()) {
-        id_to_post.erase(it);
+private:
+  template<class P, class... Args>
+  std::shared_ptr<P> post(std::size_t id, Args &&...args) {
+    std::lock_guard lg { mutex };
 
-        return;
-      }
+    auto &slot = slots[id];
+    if(auto post = slot.lock()) {
+      return std::static_pointer_cast<P>(std::move(post));
     }
-  }
 
-  std::mutex mutex;
+    auto post = std::make_shared<P>(shared_from_this(), id, std::forward<Args>(args)...);
+    slot      = post;
 
-  std::map<std::string, std::weak_ptr<void>, std::less<>> id_to_post;
+    return post;
+  }
 };
 
-inline void cleanup(mail_raw_t *mail) {
-  mail->cleanup();
+inline void cleanup(mail_raw_t *mail, std::size_t id) {
+  mail->cleanup(id);
 }
 } // namespace safe
 
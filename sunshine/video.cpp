@@ -4,18 +4,29 @@
 
 #include <atomic>
 #include <bitset>
+#include <cmath>
+#include <filesystem>
+#include <map>
+#include <random>
+#include <sstream>
 #include <thread>
 
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+
 extern "C" {
+#include <libavutil/opt.h>
 #include <libswscale/swscale.h>
 }
 
 #include "cbs.h"
 #include "config.h"
+#include "convert.h"
+#include "cpu_budget.h"
+#include "img_pool.h"
 #include "input.h"
 #include "main.h"
 #include "platform/common.h"
-#include "round_robin.h"
 #include "sync.h"
 #include "video.h"
 
@@ -27,10 +38,15 @@ extern "C" {
 
 using namespace std::literals;
 namespace video {
+namespace fs = std::filesystem;
+namespace pt = boost::property_tree;
 
 constexpr auto hevc_nalu = "\000\000\000\001("sv;
 constexpr auto h264_nalu = "\000\000\000\001e"sv;
 
+// Frames of a software encode pipeline: one being converted, one waiting and one being encoded
+constexpr int PIPELINE_FRAMES = 3;
+
 void free_ctx(AVCodecContext *ctx) {
   avcodec_free_context(&ctx);
 }
@@ -75,39 +91,54 @@ util::Either<buffer_t, int> cuda_make_hwdevice_ctx(platf::hwdevice_t *hwdevice_c
 
 int hwframe_ctx(ctx_t &ctx, buffer_t &hwdevice, AVPixelFormat format);
 
+// Cleared by init() if the dedicated converter deviates from swscale
+static bool use_converter = true;
+
 class swdevice_t : public platf::hwdevice_t {
 public:
+  // Partial conversions work on whole rows of macroblocks
+  static constexpr int BAND_HEIGHT = 16;
+
   int convert(platf::img_t &img) override {
-    av_frame_make_writable(sw_frame.get());
+    auto begin = std::chrono::steady_clock::now();
 
-    const int linesizes[2] {
-      img.row_pitch, 0
-    };
+    // The damage of img is only usable if it was captured right after the image converted last
+    auto contiguous = capture_seq && img.capture_seq == capture_seq + 1 && !img.damage.empty();
+    for(auto &target : targets) {
+      if(!contiguous) {
+        target.stale = true;
+      }
+      else if(!target.stale) {
+        target.damage.insert(std::end(target.damage), std::begin(img.damage), std::end(img.damage));
+      }
+    }
+    capture_seq = img.capture_seq;
 
-    std::uint8_t *data[4];
+    current      = (current + 1) % (int)targets.size();
+    auto &target = targets[current];
 
-    data[0] = sw_frame->data[0] + offsetY;
-    if(sw_frame->format == AV_PIX_FMT_NV12) {
-      data[1] = sw_frame->data[1] + offsetUV * 2;
-      data[2] = nullptr;
-    }
-    else {
-      data[1] = sw_frame->data[1] + offsetUV;
-      data[2] = sw_frame->data[2] + offsetUV;
-      data[3] = nullptr;
+    sw_frame = target.frame.get();
+    if(!hw_frame) {
+      frame = sw_frame;
     }
 
-    int ret = sws_scale(sws.get(), (std::uint8_t *const *)&img.data, linesizes, 0, img.height, data, sw_frame->linesize);
-    if(ret <= 0) {
-      BOOST_LOG(error) << "Couldn't convert image to required format and/or size"sv;
+    av_frame_make_writable(sw_frame);
 
+    auto partial = (converter || sws_band) && !target.stale;
+
+    target.stale = true;
+    if(partial ? convert_damage(img, target.damage) : convert_full(img)) {
       return -1;
     }
+    target.stale = false;
+    target.damage.clear();
+
+    record_convert_time(std::chrono::steady_clock::now() - begin);
 
     // If frame is not a software frame, it means we still need to transfer from main memory
     // to vram memory
     if(frame->hw_frames_ctx) {
-      auto status = av_hwframe_transfer_data(frame, sw_frame.get(), 0);
+      auto status = av_hwframe_transfer_data(frame, sw_frame, 0);
       if(status < 0) {
         char string[AV_ERROR_MAX_STRING_SIZE];
         BOOST_LOG(error) << "Failed to transfer image data to hardware frame: "sv << av_make_error_string(string, AV_ERROR_MAX_STRING_SIZE, status);
@@ -118,6 +149,166 @@ public:
     return 0;
   }
 
+  /**
+   * Point data at row dst_y of the converted area in sw_frame
+   */
+  void planes(int dst_y, std::uint8_t **data) {
+    data[0] = sw_frame->data[0] + offsetY + dst_y * sw_frame->linesize[0];
+    if(sw_frame->format == AV_PIX_FMT_NV12) {
+      data[1] = sw_frame->data[1] + offsetUV * 2 + dst_y / 2 * sw_frame->linesize[1];
+      data[2] = nullptr;
+    }
+    else {
+      data[1] = sw_frame->data[1] + offsetUV + dst_y / 2 * sw_frame->linesize[1];
+      data[2] = sw_frame->data[2] + offsetUV + dst_y / 2 * sw_frame->linesize[2];
+      data[3] = nullptr;
+    }
+  }
+
+  /**
+   * Convert src_height rows of img, starting at src_y, into sw_frame starting at row dst_y of the converted area
+   */
+  int scale(SwsContext *ctx, platf::img_t &img, int src_y, int src_height, int dst_y) {
+    const int linesizes[2] {
+      img.row_pitch, 0
+    };
+
+    std::uint8_t *src = img.data + src_y * img.row_pitch;
+    std::uint8_t *data[4];
+    planes(dst_y, data);
+
+    return sws_scale(ctx, &src, linesizes, 0, src_height, data, sw_frame->linesize) > 0 ? 0 : -1;
+  }
+
+  /**
+   * Convert the rows [dst_y, dst_end) of the converted area, when converter can handle the image
+   */
+  void convert_rows(platf::img_t &img, int dst_y, int dst_end) {
+    std::uint8_t *data[4];
+    planes(0, data);
+
+    converter.convert(img.data, img.row_pitch, data, sw_frame->linesize, dst_y, dst_end);
+  }
+
+  int convert_full(platf::img_t &img) {
+    if(converter) {
+      if(bands.empty()) {
+        convert_rows(img, 0, converter.height());
+      }
+      else {
+        task_pool.parallel_for((int)bands.size(), [&](int x) {
+          convert_rows(img, bands[x].dst_y, bands[x].dst_end);
+        });
+      }
+
+      return 0;
+    }
+
+    if(bands.empty()) {
+      if(scale(sws.get(), img, 0, img.height, 0)) {
+        BOOST_LOG(error) << "Couldn't convert image to required format and/or size"sv;
+
+        return -1;
+      }
+
+      return 0;
+    }
+
+    std::atomic_bool failed { false };
+    task_pool.parallel_for((int)bands.size(), [&](int x) {
+      auto &band = bands[x];
+
+      if(scale(band.sws.get(), img, band.src_y, band.src_height, band.dst_y)) {
+        failed = true;
+      }
+    });
+
+    if(failed) {
+      BOOST_LOG(error) << "Couldn't convert image to required format and/or size"sv;
+
+      return -1;
+    }
+
+    return 0;
+  }
+
+  /**
+   * Only convert the bands of BAND_HEIGHT rows touched by damage, the areas of img that differ from sw_frame.
+   * A swscale context is bound to a single size, so the bands span the full width.
+   */
+  int convert_damage(platf::img_t &img, const std::vector<platf::rect_t> &damage) {
+    // The bands are counted in rows of the converted area
+    auto factor = converter ? converter.factor() : 1;
+    auto height = img.height / factor;
+
+    auto count = (height + BAND_HEIGHT - 1) / BAND_HEIGHT;
+    damaged_bands.assign(count, false);
+
+    int damaged = 0;
+    for(auto &rect : damage) {
+      auto begin = std::clamp(rect.y / factor / BAND_HEIGHT, 0, count);
+      auto end   = std::clamp(((rect.y + rect.height + factor - 1) / factor + BAND_HEIGHT - 1) / BAND_HEIGHT, 0, count);
+
+      for(auto band = begin; band < end; ++band) {
+        if(!damaged_bands[band]) {
+          damaged_bands[band] = true;
+          ++damaged;
+        }
+      }
+    }
+
+    // Past this point, a single call for the whole image is cheaper
+    if(damaged * 2 > count) {
+      return convert_full(img);
+    }
+
+    for(int band = 0; band < count; ++band) {
+      if(!damaged_bands[band]) {
+        continue;
+      }
+
+      auto y    = band * BAND_HEIGHT;
+      auto rows = std::min(BAND_HEIGHT, height - y);
+
+      if(converter) {
+        convert_rows(img, y, y + rows);
+
+        continue;
+      }
+
+      if(scale(rows == BAND_HEIGHT ? sws_band.get() : sws_tail.get(), img, y, rows, y)) {
+        BOOST_LOG(error) << "Couldn't convert damaged area of image"sv;
+
+        return -1;
+      }
+    }
+
+    return 0;
+  }
+
+  void record_convert_time(std::chrono::nanoseconds duration) {
+    convert_time.total += duration;
+    convert_time.max = std::max(convert_time.max, duration);
+    ++convert_time.frames;
+
+    auto now = std::chrono::steady_clock::now();
+    if(now < convert_time.next_report) {
+      return;
+    }
+
+    if(convert_time.frames > 1) {
+      auto ms = [](std::chrono::nanoseconds ns) {
+        return std::chrono::duration<double, std::milli>(ns).count();
+      };
+
+      BOOST_LOG(debug)
+        << "Color conversion over "sv << convert_time.frames << " frames: average "sv
+        << ms(convert_time.total / convert_time.frames) << "ms, max "sv << ms(convert_time.max) << "ms"sv;
+    }
+
+    convert_time = { 0ns, 0ns, 0, now + 10s };
+  }
+
   int set_frame(AVFrame *frame) {
     this->frame = frame;
 
@@ -129,24 +320,92 @@ public:
     }
 
     if(!frame->hw_frames_ctx) {
-      sw_frame.reset(frame);
+      targets.emplace_back().frame.reset(frame);
+      sw_frame = frame;
+    }
+
+    return 0;
+  }
+
+  /**
+   * Convert into count software frames in turn, so an encoder can still read the frames
+   * of the previous count - 1 images while the next image is converted.
+   * frame points to the frame converted last.
+   */
+  int buffer(int count) {
+    if(hw_frame) {
+      return -1;
+    }
+
+    while((int)targets.size() < count) {
+      frame_t frame { av_frame_alloc() };
+      frame->format = sw_frame->format;
+      frame->width  = sw_frame->width;
+      frame->height = sw_frame->height;
+
+      // Copy the black padding around the converted area
+      if(av_frame_get_buffer(frame.get(), 0) || av_frame_copy(frame.get(), sw_frame) < 0) {
+        return -1;
+      }
+
+      targets.emplace_back().frame = std::move(frame);
     }
 
     return 0;
   }
 
+  /**
+   * Forget the images converted so far, the next image is converted in full
+   */
+  void reset() {
+    capture_seq = 0;
+
+    for(auto &target : targets) {
+      target.stale = true;
+      target.damage.clear();
+    }
+  }
+
   void set_colorspace(std::uint32_t colorspace, std::uint32_t color_range) override {
-    sws_setColorspaceDetails(sws.get(),
-      sws_getCoefficients(SWS_CS_DEFAULT), 0,
-      sws_getCoefficients(colorspace), color_range - 1,
-      0, 1 << 16, 1 << 16);
+    if(converter) {
+      auto color_p = &colors[0];
+      if(colorspace == SWS_CS_ITU709) {
+        color_p = &colors[2];
+      }
+      else if(colorspace == SWS_CS_BT2020) {
+        color_p = &colors[4];
+      }
+
+      // Full range
+      if(color_range > 1) {
+        ++color_p;
+      }
+
+      converter.set_colorspace(*color_p);
+    }
+
+    std::vector<SwsContext *> contexts { sws.get(), sws_band.get(), sws_tail.get() };
+    for(auto &band : bands) {
+      contexts.emplace_back(band.sws.get());
+    }
+
+    for(auto ctx : contexts) {
+      if(!ctx) {
+        continue;
+      }
+
+      sws_setColorspaceDetails(ctx,
+        sws_getCoefficients(SWS_CS_DEFAULT), 0,
+        sws_getCoefficients(colorspace), color_range - 1,
+        0, 1 << 16, 1 << 16);
+    }
   }
 
   /**
    * When preserving aspect ratio, ensure that padding is black
    */
   int prefill() {
-    auto frame  = sw_frame ? sw_frame.get() : this->frame;
+    auto frame  = sw_frame ? sw_frame : this->frame;
     auto width  = frame->width;
     auto height = frame->height;
 
@@ -183,10 +442,14 @@ public:
     return 0;
   }
 
-  int init(int in_width, int in_height, AVFrame *frame, AVPixelFormat format) {
+  /**
+   * threads --> The number of threads converting a single image
+   */
+  int init(int in_width, int in_height, AVFrame *frame, AVPixelFormat format, int threads) {
     // If the device used is hardware, yet the image resides on main memory
     if(frame->hw_frames_ctx) {
-      sw_frame.reset(av_frame_alloc());
+      targets.emplace_back().frame.reset(av_frame_alloc());
+      sw_frame = targets.back().frame.get();
 
       sw_frame->width  = frame->width;
       sw_frame->height = frame->height;
@@ -214,13 +477,90 @@ public:
     offsetUV     = (offsetW + offsetH * frame->width / 2) / 2;
     offsetY      = offsetW + offsetH * frame->width;
 
+    // Unscaled and halved images have a dedicated converter, swscale handles everything else
+    if(use_converter && !converter.init(map_pix_fmt(format), in_width, in_height, out_width, out_height)) {
+      BOOST_LOG(debug) << "Converting images without swscale"sv;
+
+      return init_bands(in_width, in_height, out_width, out_height, format, threads);
+    }
+
     sws.reset(sws_getContext(
       in_width, in_height, AV_PIX_FMT_BGR0,
       out_width, out_height, format,
       SWS_LANCZOS | SWS_ACCURATE_RND,
       nullptr, nullptr, nullptr));
 
-    return sws ? 0 : -1;
+    if(!sws) {
+      return -1;
+    }
+
+    // Converting damaged bands on their own is only possible when the image isn't scaled
+    if(in_width == frame->width && in_height == frame->height) {
+      sws_band.reset(sws_getContext(
+        in_width, BAND_HEIGHT, AV_PIX_FMT_BGR0,
+        in_width, BAND_HEIGHT, format,
+        SWS_LANCZOS | SWS_ACCURATE_RND,
+        nullptr, nullptr, nullptr));
+
+      if(auto tail = in_height % BAND_HEIGHT) {
+        sws_tail.reset(sws_getContext(
+          in_width, tail, AV_PIX_FMT_BGR0,
+          in_width, tail, format,
+          SWS_LANCZOS | SWS_ACCURATE_RND,
+          nullptr, nullptr, nullptr));
+
+        if(!sws_tail) {
+          sws_band.reset();
+        }
+      }
+    }
+
+    return init_bands(in_width, in_height, out_width, out_height, format, threads);
+  }
+
+  /**
+   * Split the full conversion in horizontal bands of whole macroblock rows, converted in parallel.
+   * With swscale, the vertical filter is clamped at the edges of a band, the same as at the edges of the image.
+   */
+  int init_bands(int in_width, int in_height, int out_width, int out_height, AVPixelFormat format, int threads) {
+    auto rows  = out_height / BAND_HEIGHT;
+    auto count = std::min(threads, rows);
+    if(count <= 1) {
+      return 0;
+    }
+
+    bands.resize(count);
+    for(int x = 0; x < count; ++x) {
+      auto &band = bands[x];
+
+      auto dst_end = x + 1 == count ? out_height : rows * (x + 1) / count * BAND_HEIGHT;
+      band.dst_y   = rows * x / count * BAND_HEIGHT;
+
+      auto src_end = x + 1 == count ? in_height : dst_end * in_height / out_height;
+      band.src_y   = band.dst_y * in_height / out_height;
+
+      band.src_height = src_end - band.src_y;
+      band.dst_end    = dst_end;
+
+      // The converter works on rows of the converted area directly
+      if(converter) {
+        continue;
+      }
+
+      band.sws.reset(sws_getContext(
+        in_width, band.src_height, AV_PIX_FMT_BGR0,
+        out_width, dst_end - band.dst_y, format,
+        SWS_LANCZOS | SWS_ACCURATE_RND,
+        nullptr, nullptr, nullptr));
+
+      if(!band.sws) {
+        return -1;
+      }
+    }
+
+    BOOST_LOG(debug) << "Converting images in "sv << count << " bands"sv;
+
+    return 0;
   }
 
   ~swdevice_t() override {}
@@ -228,14 +568,236 @@ public:
   // Store ownsership when frame is hw_frame
   frame_t hw_frame;
 
-  frame_t sw_frame;
+  struct target_t {
+    frame_t frame;
+
+    // The areas of the image converted last that differ from the image in frame, unused while stale
+    std::vector<platf::rect_t> damage;
+    bool stale { true };
+  };
+
+  // The frames converted into in turn, frame is the first one unless it's a hw_frame
+  std::vector<target_t> targets;
+  int current {};
+
+  // The frame of the current target
+  AVFrame *sw_frame {};
+
   sws_t sws;
 
+  // Convert a band of BAND_HEIGHT rows, and the remaining rows at the bottom of the image
+  sws_t sws_band;
+  sws_t sws_tail;
+
+  std::vector<bool> damaged_bands;
+
+  convert::converter_t converter;
+
+  struct band_t {
+    sws_t sws;
+
+    int src_y, src_height;
+    int dst_y, dst_end;
+  };
+
+  // When not empty, full conversions are split over these
+  std::vector<band_t> bands;
+
+  struct {
+    std::chrono::nanoseconds total;
+    std::chrono::nanoseconds max;
+    int frames;
+
+    std::chrono::steady_clock::time_point next_report;
+  } convert_time {};
+
+  // platf::img_t::capture_seq of the image converted last, 0 if unknown
+  std::uint64_t capture_seq {};
+
   // offset of input image to output frame in pixels
   int offsetUV;
   int offsetY;
 };
 
+/**
+ * Compare the dedicated converter with swscale for every format, colorspace, range and ratio it handles.
+ * For the 2:1 ratio, the source is made of 2x2 blocks of the image swscale converts unscaled,
+ * the box filter of the converter then averages exactly the pixels swscale gets.
+ *
+ * Returns false if any plane deviates from swscale, either by its PSNR or by a bias of its samples.
+ */
+static bool validate_converter() {
+  constexpr int width  = 128;
+  constexpr int height = 64;
+
+  constexpr double min_psnr = 40.0;
+  constexpr double max_bias = 0.5;
+
+  // Smooth, so the chroma subsampling of either agrees.
+  // Each channel rises and falls again, a difference in chroma siting doesn't add up to a bias
+  auto triangle = [](int x, int period) {
+    x %= period;
+    return (x < period / 2 ? x : period - x) * 2 * 255 / period;
+  };
+
+  std::vector<std::uint32_t> image(width * height);
+  std::vector<std::uint32_t> doubled(width * height * 4);
+  for(int y = 0; y < height; ++y) {
+    for(int x = 0; x < width; ++x) {
+      std::uint32_t r = triangle(x, width), g = triangle(y, height), b = triangle(x + y * 2, width);
+
+      // BGR0 in memory
+      auto pixel = b | g << 8 | r << 16;
+
+      image[y * width + x] = pixel;
+      for(int dy = 0; dy < 2; ++dy) {
+        std::fill_n(&doubled[(y * 2 + dy) * width * 2 + x * 2], 2, pixel);
+      }
+    }
+  }
+
+  struct format_t {
+    AVPixelFormat format;
+    std::string_view name;
+    int bits;
+    bool interleaved;
+  };
+
+  struct colorspace_t {
+    int sws_colorspace;
+    std::string_view name;
+
+    // The limited range entry of colors, the full range one follows it
+    int color;
+  };
+
+  const format_t formats[] {
+    { AV_PIX_FMT_YUV420P, "yuv420p"sv, 8, false },
+    { AV_PIX_FMT_YUV420P10, "yuv420p10"sv, 10, false },
+    { AV_PIX_FMT_NV12, "nv12"sv, 8, true },
+    { AV_PIX_FMT_P010, "p010"sv, 10, true },
+  };
+
+  const colorspace_t colorspaces[] {
+    { SWS_CS_SMPTE170M, "BT.601"sv, 0 },
+    { SWS_CS_ITU709, "BT.709"sv, 2 },
+    { SWS_CS_BT2020, "BT.2020"sv, 4 },
+  };
+
+  auto alloc_frame = [](AVPixelFormat format) {
+    frame_t frame { av_frame_alloc() };
+    frame->width  = width;
+    frame->height = height;
+    frame->format = format;
+
+    if(av_frame_get_buffer(frame.get(), 0)) {
+      frame.reset();
+    }
+
+    return frame;
+  };
+
+  // The samples of a row, P010 keeps them in the upper bits
+  auto sample = [](const format_t &format, const std::uint8_t *row, int x) -> int {
+    if(format.bits == 8) {
+      return row[x];
+    }
+
+    auto word = ((const std::uint16_t *)row)[x];
+    return format.format == AV_PIX_FMT_P010 ? word >> 6 : word;
+  };
+
+  for(auto &format : formats) {
+    for(auto &colorspace : colorspaces) {
+      for(int full = 0; full < 2; ++full) {
+        auto expected = alloc_frame(format.format);
+        if(!expected) {
+          return false;
+        }
+
+        sws_t sws {
+          sws_getContext(
+            width, height, AV_PIX_FMT_BGR0,
+            width, height, format.format,
+            SWS_LANCZOS | SWS_ACCURATE_RND,
+            nullptr, nullptr, nullptr)
+        };
+        if(!sws) {
+          return false;
+        }
+
+        sws_setColorspaceDetails(sws.get(),
+          sws_getCoefficients(SWS_CS_DEFAULT), 0,
+          sws_getCoefficients(colorspace.sws_colorspace), full,
+          0, 1 << 16, 1 << 16);
+
+        auto src = (const std::uint8_t *)image.data();
+        const int linesizes[2] { width * 4, 0 };
+        if(sws_scale(sws.get(), &src, linesizes, 0, height, expected->data, expected->linesize) <= 0) {
+          return false;
+        }
+
+        for(int factor = 1; factor <= 2; ++factor) {
+          auto actual = alloc_frame(format.format);
+          if(!actual) {
+            return false;
+          }
+
+          convert::converter_t converter;
+          if(converter.init(map_pix_fmt(format.format), width * factor, height * factor, width, height)) {
+            return false;
+          }
+          converter.set_colorspace(colors[colorspace.color + full]);
+
+          auto source = factor == 1 ? image.data() : doubled.data();
+          converter.convert((const std::uint8_t *)source, width * factor * 4, actual->data, actual->linesize, 0, height);
+
+          auto max = (double)((1 << format.bits) - 1);
+
+          // NV12 and P010 hold both chroma planes in the second one
+          auto planes = format.interleaved ? 2 : 3;
+          for(int plane = 0; plane < planes; ++plane) {
+            auto plane_width  = plane == 0 || format.interleaved ? width : width / 2;
+            auto plane_height = plane == 0 ? height : height / 2;
+
+            double sum {}, sum_squared {};
+            for(int y = 0; y < plane_height; ++y) {
+              auto row_expected = expected->data[plane] + y * expected->linesize[plane];
+              auto row_actual   = actual->data[plane] + y * actual->linesize[plane];
+
+              for(int x = 0; x < plane_width; ++x) {
+                auto diff = (double)(sample(format, row_actual, x) - sample(format, row_expected, x));
+
+                sum += diff;
+                sum_squared += diff * diff;
+              }
+            }
+
+            auto samples = (double)plane_width * plane_height;
+            auto bias    = sum / samples;
+            auto mse     = sum_squared / samples;
+            auto psnr    = mse > 0.0 ? 10.0 * std::log10(max * max / mse) : std::numeric_limits<double>::infinity();
+
+            BOOST_LOG(verbose)
+              << "Color conversion "sv << format.name << ' ' << colorspace.name << (full ? " full"sv : " limited"sv) << " range "sv
+              << factor << ":1, plane "sv << plane << ": PSNR "sv << psnr << " dB, bias "sv << bias;
+
+            if(psnr < min_psnr || std::abs(bias) > max_bias) {
+              BOOST_LOG(warning)
+                << "Color conversion of "sv << format.name << ' ' << colorspace.name << (full ? " full"sv : " limited"sv) << " range at "sv
+                << factor << ":1 deviates from swscale in plane "sv << plane << ": PSNR "sv << psnr << " dB, bias "sv << bias;
+
+              return false;
+            }
+          }
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
 enum flag_e {
   DEFAULT           = 0x00,
   PARALLEL_ENCODING = 0x01,
@@ -336,7 +898,10 @@ public:
     sps          = std::move(other.sps);
     vps          = std::move(other.vps);
 
-    inject = other.inject;
+    inject     = other.inject;
+    in_flight  = other.in_flight;
+    next_pts   = other.next_pts;
+    pts_offset = other.pts_offset;
 
     return *this;
   }
@@ -351,6 +916,13 @@ public:
 
   // inject sps/vps data into idr pictures
   int inject;
+
+  // Frames sent to the encoder that haven't come out as a packet yet
+  int in_flight {};
+
+  // A reused encoder continues the timestamps of its previous stream, packets are given the frame numbers of the current one
+  std::int64_t next_pts {};
+  std::int64_t pts_offset {};
 };
 
 struct sync_session_ctx_t {
@@ -370,6 +942,10 @@ struct sync_session_t {
 
   platf::img_t *img_tmp;
   session_t session;
+
+  // The frame holds the current image, unchanged images don't need to be converted again
+  bool converted {};
+  std::chrono::steady_clock::time_point next_idle_frame;
 };
 
 using encode_session_ctx_queue_t = safe::queue_t<sync_session_ctx_t>;
@@ -378,35 +954,137 @@ using encode_e                   = platf::capture_e;
 struct capture_ctx_t {
   img_event_t images;
   int framerate;
+
+  // The size of the stream, the images needn't be any larger
+  int width, height;
 };
 
 struct capture_thread_async_ctx_t {
   std::shared_ptr<safe::queue_t<capture_ctx_t>> capture_ctx_queue;
   std::thread capture_thread;
 
-  safe::signal_t reinit_event;
+  safe::signal_t reinit_event { util::lock_site_t { "video::reinit_event" } };
   const encoder_t *encoder_p;
-  util::sync_t<std::weak_ptr<platf::display_t>> display_wp;
+  util::sync_t<std::weak_ptr<platf::display_t>> display_wp { util::lock_site_t { "video::display_wp" } };
 };
 
 struct capture_thread_sync_ctx_t {
-  encode_session_ctx_queue_t encode_session_ctx_queue { 30 };
+  encode_session_ctx_queue_t encode_session_ctx_queue { 30, safe::overflow_e::block, "video::encode_session_ctx_queue" };
 };
 
 int start_capture_sync(capture_thread_sync_ctx_t &ctx);
 void end_capture_sync(capture_thread_sync_ctx_t &ctx);
-int start_capture_async(capture_thread_async_ctx_t &ctx);
+int start_capture_async(capture_thread_async_ctx_t &ctx, const std::string &display_name);
 void end_capture_async(capture_thread_async_ctx_t &ctx);
 
 // Keep a reference counter to ensure the capture thread only runs when other threads have a reference to the capture thread
-auto capture_thread_async = safe::make_shared<capture_thread_async_ctx_t>(start_capture_async, end_capture_async);
-auto capture_thread_sync  = safe::make_shared<capture_thread_sync_ctx_t>(start_capture_sync, end_capture_sync);
+auto capture_thread_sync = safe::make_shared<capture_thread_sync_ctx_t>(start_capture_sync, end_capture_sync);
 
-static encoder_t nvenc {
-  "nvenc"sv,
-  { (int)nv::profile_h264_e::high, (int)nv::profile_hevc_e::main, (int)nv::profile_hevc_e::main_10 },
-#ifdef _WIN32
-  AV_HWDEVICE_TYPE_D3D11VA,
+/**
+ * Each display is captured by a thread of its own, shared by the sessions streaming that display
+ */
+class capture_threads_async_t {
+public:
+  using ptr_t = safe::shared_t<capture_thread_async_ctx_t>::ptr_t;
+
+  /**
+   * Returns a reference to the capture thread of display_name, starting it if no session references it yet
+   */
+  ptr_t ref(const std::string &display_name) {
+    std::lock_guard lg { lock };
+
+    auto pos = threads.find(display_name);
+    if(pos == std::end(threads)) {
+      pos = threads.emplace(
+                     std::piecewise_construct,
+                     std::forward_as_tuple(display_name),
+                     std::forward_as_tuple(
+                       [display_name](capture_thread_async_ctx_t &ctx) {
+                         return start_capture_async(ctx, display_name);
+                       },
+                       end_capture_async))
+              .first;
+    }
+
+    return pos->second.ref();
+  }
+
+  /**
+   * Keep capturing the display of ref for a while after a session switched away from it,
+   * switching back then doesn't wait for the display to be initialized again
+   */
+  void keep_warm(ptr_t &&ref) {
+    using namespace std::literals;
+
+    {
+      std::lock_guard lg { lock };
+
+      warm.emplace_back(std::chrono::steady_clock::now() + 10s, std::move(ref));
+    }
+
+    task_pool.pushDelayed([this]() { cool_down(); }, 10s);
+  }
+
+  /**
+   * Release every display kept warm, their capture threads are joined by the caller
+   */
+  void clear() {
+    decltype(warm) expired;
+    {
+      std::lock_guard lg { lock };
+
+      expired.swap(warm);
+    }
+  }
+
+private:
+  /**
+   * Release the displays kept warm past their grace period
+   */
+  void cool_down() {
+    // Stopping a capture thread joins it, that happens outside the lock
+    std::vector<ptr_t> expired;
+    {
+      std::lock_guard lg { lock };
+
+      auto now = std::chrono::steady_clock::now();
+      KITTY_WHILE_LOOP(auto pos = std::begin(warm), pos != std::end(warm), {
+        if(pos->first > now) {
+          ++pos;
+          continue;
+        }
+
+        expired.emplace_back(std::move(pos->second));
+        pos = warm.erase(pos);
+      })
+    }
+
+    if(expired.empty()) {
+      return;
+    }
+
+    // Joining may wait for a snapshot to time out, that mustn't hold up the input tasks on the serial lane
+    task_pool.spawn([expired = std::move(expired)]() mutable {
+      expired.clear();
+    });
+  }
+
+  std::mutex lock;
+
+  // A node based map, the contexts must stay in place
+  std::map<std::string, safe::shared_t<capture_thread_async_ctx_t>> threads;
+
+  // Displays no session streams anymore, with the time they may stop
+  std::vector<std::pair<std::chrono::steady_clock::time_point, ptr_t>> warm;
+};
+
+static capture_threads_async_t capture_threads_async;
+
+static encoder_t nvenc {
+  "nvenc"sv,
+  { (int)nv::profile_h264_e::high, (int)nv::profile_hevc_e::main, (int)nv::profile_hevc_e::main_10 },
+#ifdef _WIN32
+  AV_HWDEVICE_TYPE_D3D11VA,
   AV_PIX_FMT_D3D11,
 #else
   AV_HWDEVICE_TYPE_CUDA,
@@ -487,6 +1165,7 @@ static encoder_t software {
     // kicked to the 2nd packet in the frame, breaking Moonlight's parsing logic.
     // It also looks like gop_size isn't passed on to x265, so we have to set
     // 'keyint=-1' in the parameters ourselves.
+    // make_session adds the threading parameters, see x265_params()
     {
       { "forced-idr"s, 1 },
       { "x265-params"s, "info=0:keyint=-1"s },
@@ -504,7 +1183,7 @@ static encoder_t software {
     std::make_optional<encoder_t::option_t>("qp"s, &config::video.qp),
     "libx264"s,
   },
-  H264_ONLY | PARALLEL_ENCODING,
+  PARALLEL_ENCODING,
 
   nullptr
 };
@@ -566,7 +1245,8 @@ void captureThread(
   std::shared_ptr<safe::queue_t<capture_ctx_t>> capture_ctx_queue,
   util::sync_t<std::weak_ptr<platf::display_t>> &display_wp,
   safe::signal_t &reinit_event,
-  const encoder_t &encoder) {
+  const encoder_t &encoder,
+  const std::string &display_name) {
   std::vector<capture_ctx_t> capture_ctxs;
 
   auto fg = util::fail_guard([&]() {
@@ -576,112 +1256,170 @@ void captureThread(
     for(auto &capture_ctx : capture_ctxs) {
       capture_ctx.images->stop();
     }
-    for(auto &capture_ctx : capture_ctx_queue->unsafe()) {
+    for(auto &capture_ctx : capture_ctx_queue->drain()) {
       capture_ctx.images->stop();
     }
   });
 
-  auto switch_display_event = mail::man->event<int>(mail::switch_display);
-
-  // Get all the monitor names now, rather than at boot, to
-  // get the most up-to-date list available monitors
-  auto display_names = platf::display_names(map_dev_type(encoder.dev_type));
-  int display_p      = 0;
-
-  if(display_names.empty()) {
-    display_names.emplace_back(config::video.output_name);
-  }
-
-  for(int x = 0; x < display_names.size(); ++x) {
-    if(display_names[x] == config::video.output_name) {
-      display_p = x;
-
-      break;
-    }
-  }
-
   if(auto capture_ctx = capture_ctx_queue->pop()) {
     capture_ctxs.emplace_back(std::move(*capture_ctx));
   }
+  else {
+    return;
+  }
+
+  // The display is kept warm without any session, it's remade at the framerate of the last session that joined
+  auto framerate = capture_ctxs.front().framerate;
 
-  auto disp = platf::display(map_dev_type(encoder.dev_type), display_names[display_p], capture_ctxs.front().framerate);
+  auto disp = platf::display(map_dev_type(encoder.dev_type), display_name, framerate);
   if(!disp) {
     return;
   }
-  display_wp = disp;
 
-  std::vector<std::shared_ptr<platf::img_t>> imgs(12);
-  auto round_robin = util::make_round_robin<std::shared_ptr<platf::img_t>>(std::begin(imgs), std::end(imgs));
+  img_pool_t img_pool { 12, [&capture_ctx_queue]() { return capture_ctx_queue->running(); } };
+  img_pool.reset([&disp]() { return disp->alloc_img(); });
+
+  // The most recent image that changed, sessions joining while nothing changes start from it
+  std::shared_ptr<platf::img_t> last_img;
+  std::uint64_t capture_seq = 0;
+
+  // The size the display was last scaled to fit
+  int requested_width {}, requested_height {};
+
+  // Software encoders convert the images on the CPU, the display scales them down to the largest stream before they're read back.
+  //
+  // Changing the size of the images makes every software session on the display remake its encoder and send a keyframe.
+  // So while sessions are running, the images only grow for a session that asks for more than they hold.
+  // A session leaving doesn't shrink them, the others read back more than they need until they're all gone instead.
+  //
+  // running --> Sessions are streaming the current images
+  auto rescale = [&](bool running) {
+    if(encoder.dev_type != AV_HWDEVICE_TYPE_NONE) {
+      return;
+    }
+
+    int width {}, height {};
+    for(auto &capture_ctx : capture_ctxs) {
+      width  = std::max(width, capture_ctx.width);
+      height = std::max(height, capture_ctx.height);
+    }
+
+    if(running) {
+      width  = std::max(width, requested_width);
+      height = std::max(height, requested_height);
+    }
+
+    requested_width  = width;
+    requested_height = height;
 
-  for(auto &img : imgs) {
-    img = disp->alloc_img();
-    if(!img) {
-      BOOST_LOG(error) << "Couldn't initialize an image"sv;
+    if(!disp->scale_to(width, height)) {
       return;
     }
+
+    auto [img_width, img_height] = disp->img_size();
+    BOOST_LOG(info) << "Capturing display ["sv << display_name << "] into "sv << img_width << 'x' << img_height << " images"sv;
+
+    img_pool.reset([&disp]() { return disp->alloc_img(); });
+
+    // The next image is changed as a whole, it's raised to every session, including those joining until then
+    last_img.reset();
+  };
+
+  rescale(false);
+
+  // The sessions size their encoder by the images, they wait for the display until they're scaled
+  display_wp = disp;
+
+  auto first_img = img_pool.acquire();
+  if(!first_img) {
+    return;
   }
 
   while(capture_ctx_queue->running()) {
-    bool artificial_reinit = false;
-
     auto status = disp->capture([&](std::shared_ptr<platf::img_t> &img) -> std::shared_ptr<platf::img_t> {
+      // An unchanged image may not even have been filled
+      if(!img->unchanged) {
+        img->capture_seq = ++capture_seq;
+        last_img         = img;
+      }
+
+      bool sessions_changed = false;
+
       KITTY_WHILE_LOOP(auto capture_ctx = std::begin(capture_ctxs), capture_ctx != std::end(capture_ctxs), {
         if(!capture_ctx->images->running()) {
           capture_ctx = capture_ctxs.erase(capture_ctx);
 
+          // The session no longer holds on to images
+          img_pool.trim();
+
+          sessions_changed = true;
           continue;
         }
 
-        capture_ctx->images->raise(img);
+        if(!img->unchanged) {
+          capture_ctx->images->raise(img);
+        }
         ++capture_ctx;
       })
 
       if(!capture_ctx_queue->running()) {
         return nullptr;
       }
+      auto joined = capture_ctxs.size();
       while(capture_ctx_queue->peek()) {
-        capture_ctxs.emplace_back(std::move(*capture_ctx_queue->pop()));
-      }
+        auto capture_ctx = capture_ctx_queue->pop();
+        if(!capture_ctx) {
+          break;
+        }
 
-      if(switch_display_event->peek()) {
-        artificial_reinit = true;
+        capture_ctxs.emplace_back(std::move(*capture_ctx));
+        framerate = capture_ctxs.back().framerate;
 
-        display_p = std::clamp(*switch_display_event->pop(), 0, (int)display_names.size() - 1);
-        return nullptr;
+        sessions_changed = true;
       }
 
-      auto &next_img = *round_robin++;
-      while(next_img.use_count() > 1) {}
-
-      return next_img;
-    },
-      *round_robin++, &display_cursor);
-
+      // The sessions that were there before any joined keep their encoders if they can
+      if(sessions_changed && !capture_ctxs.empty()) {
+        rescale(joined > 0);
+      }
 
-    if(artificial_reinit && status != platf::capture_e::error) {
-      status = platf::capture_e::reinit;
+      if(last_img) {
+        for(auto capture_ctx = std::begin(capture_ctxs) + joined; capture_ctx != std::end(capture_ctxs); ++capture_ctx) {
+          capture_ctx->images->raise(last_img);
+        }
+      }
 
-      artificial_reinit = false;
-    }
+      // Blocks while the sessions hold on to every image
+      return img_pool.acquire();
+    },
+      std::move(first_img), &display_cursor);
 
     switch(status) {
     case platf::capture_e::reinit: {
-      reinit_event.raise(true);
+      auto reinit_begin = std::chrono::steady_clock::now();
 
-      // Some classes of images contain references to the display --> display won't delete unless img is deleted
-      for(auto &img : imgs) {
-        img.reset();
+      // The hardware devices of the encoders are tied to the display, those sessions start over.
+      // Software sessions keep their encoder, they only remake it if the dimensions of the display changed
+      if(encoder.dev_type != AV_HWDEVICE_TYPE_NONE) {
+        reinit_event.raise(true);
       }
 
+      auto width  = disp->width;
+      auto height = disp->height;
+
+      // Some classes of images contain references to the display --> display won't delete unless img is deleted
+      img_pool.clear();
+      last_img.reset();
+
       // display_wp is modified in this thread only
       // Wait for the other shared_ptr's of display to be destroyed.
       // New displays will only be created in this thread.
       while(display_wp->use_count() != 1) {
-        std::this_thread::sleep_for(100ms);
+        std::this_thread::sleep_for(10ms);
       }
 
       while(capture_ctx_queue->running()) {
-        reset_display(disp, encoder.dev_type, display_names[display_p], capture_ctxs.front().framerate);
+        reset_display(disp, encoder.dev_type, display_name, framerate);
 
         if(disp) {
           break;
@@ -692,15 +1430,21 @@ void captureThread(
         return;
       }
 
+      img_pool.reset([&disp]() { return disp->alloc_img(); });
+      rescale(!capture_ctxs.empty());
+
       display_wp = disp;
 
-      // Re-allocate images
-      for(auto &img : imgs) {
-        img = disp->alloc_img();
-        if(!img) {
-          BOOST_LOG(error) << "Couldn't initialize an image"sv;
-          return;
-        }
+      first_img = img_pool.acquire();
+      if(!first_img) {
+        return;
+      }
+
+      BOOST_LOG(info)
+        << "Reinitialized display ["sv << display_name << "] in "sv
+        << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - reinit_begin).count() << "ms"sv;
+      if(disp->width != width || disp->height != height) {
+        BOOST_LOG(info) << "Display ["sv << display_name << "] changed from "sv << width << 'x' << height << " to "sv << disp->width << 'x' << disp->height;
       }
 
       reinit_event.reset();
@@ -718,7 +1462,7 @@ void captureThread(
 }
 
 int encode(int64_t frame_nr, session_t &session, frame_t::pointer frame, safe::mail_raw_t::queue_t<packet_t> &packets, void *channel_data) {
-  frame->pts = frame_nr;
+  frame->pts = frame_nr + session.pts_offset;
 
   auto &ctx = session.ctx;
 
@@ -734,6 +1478,9 @@ int encode(int64_t frame_nr, session_t &session, frame_t::pointer frame, safe::m
     return -1;
   }
 
+  ++session.in_flight;
+  session.next_pts = frame->pts + 1;
+
   while(ret >= 0) {
     auto packet = std::make_unique<packet_t::element_type>(nullptr);
 
@@ -745,6 +1492,9 @@ int encode(int64_t frame_nr, session_t &session, frame_t::pointer frame, safe::m
       return ret;
     }
 
+    --session.in_flight;
+    packet->pts -= session.pts_offset;
+
     if(session.inject) {
       if(session.inject == 1) {
         auto h264 = cbs::make_sps_h264(ctx.get(), packet.get());
@@ -778,7 +1528,180 @@ int encode(int64_t frame_nr, session_t &session, frame_t::pointer frame, safe::m
   return 0;
 }
 
-std::optional<session_t> make_session(const encoder_t &encoder, const config_t &config, int width, int height, std::shared_ptr<platf::hwdevice_t> &&hwdevice) {
+void set_bitrate(AVCodecContext *ctx, const config_t &config) {
+  auto bitrate        = config.bitrate * 1000;
+  ctx->rc_max_rate    = bitrate;
+  ctx->rc_buffer_size = bitrate / config.framerate;
+  ctx->bit_rate       = bitrate;
+  ctx->rc_min_rate    = bitrate;
+}
+
+/**
+ * The preset and encoder threads of the software encoder for the advertised resolutions and framerates,
+ * measured by `sunshine --tune` and saved in config::video.file_tuning
+ */
+class tuning_t {
+public:
+  struct entry_t {
+    int videoFormat;
+    int width, height;
+    int framerate;
+
+    std::string preset;
+    int threads;
+
+    // The 95th percentile of the encode time in milliseconds, when it was measured
+    double latency;
+
+    // False if no combination was fast enough, these are the fastest settings instead
+    bool keeps_up;
+  };
+
+  /**
+   * The tuning only holds for the host and the settings it was measured with
+   */
+  static std::string fingerprint() {
+    std::stringstream ss;
+    ss
+      << avcodec_version() << ';' << std::thread::hardware_concurrency() << ';'
+      << config::video.sw.tune << ';' << config::video.qp;
+
+    return ss.str();
+  }
+
+  void load() {
+    auto &file = config::video.file_tuning;
+    if(!fs::exists(file)) {
+      return;
+    }
+
+    std::vector<entry_t> entries;
+    try {
+      pt::ptree root;
+      pt::read_json(file, root);
+
+      if(root.get<std::string>("fingerprint"s) != fingerprint()) {
+        BOOST_LOG(warning) << "The software encoder was tuned on another host or with other settings, run sunshine --tune again"sv;
+        return;
+      }
+
+      for(auto &[_, node] : root.get_child("sessions"s)) {
+        entries.emplace_back(entry_t {
+          node.get<int>("videoFormat"s),
+          node.get<int>("width"s),
+          node.get<int>("height"s),
+          node.get<int>("framerate"s),
+          node.get<std::string>("preset"s),
+          node.get<int>("threads"s),
+          node.get<double>("latency"s),
+          // Files tuned before it was recorded are used as they were then
+          node.get("keeps_up"s, true),
+        });
+      }
+    }
+    catch(std::exception &e) {
+      BOOST_LOG(warning) << "Couldn't read "sv << file << ": "sv << e.what();
+      return;
+    }
+
+    BOOST_LOG(info) << "Loaded the software encoder tuning for "sv << entries.size() << " stream parameters"sv;
+
+    _entries = std::move(entries);
+  }
+
+  int save(const std::vector<entry_t> &entries) const {
+    auto &file = config::video.file_tuning;
+
+    pt::ptree sessions;
+    for(auto &entry : entries) {
+      pt::ptree node;
+      node.put("videoFormat"s, entry.videoFormat);
+      node.put("width"s, entry.width);
+      node.put("height"s, entry.height);
+      node.put("framerate"s, entry.framerate);
+      node.put("preset"s, entry.preset);
+      node.put("threads"s, entry.threads);
+      node.put("latency"s, entry.latency);
+      node.put("keeps_up"s, entry.keeps_up);
+
+      sessions.push_back(std::make_pair(""s, std::move(node)));
+    }
+
+    pt::ptree root;
+    root.put("fingerprint"s, fingerprint());
+    root.add_child("sessions"s, sessions);
+
+    try {
+      pt::write_json(file, root);
+    }
+    catch(std::exception &e) {
+      BOOST_LOG(error) << "Couldn't save the tuning to "sv << file << ": "sv << e.what();
+      return -1;
+    }
+
+    return 0;
+  }
+
+  /**
+   * The tuning measured for the resolution of config, at the lowest framerate that covers that of config.
+   * nullptr if there is none
+   */
+  const entry_t *find(const config_t &config) const {
+    const entry_t *best = nullptr;
+    for(auto &entry : _entries) {
+      if(
+        std::tie(entry.videoFormat, entry.width, entry.height) != std::tie(config.videoFormat, config.width, config.height) ||
+        entry.framerate < config.framerate) {
+        continue;
+      }
+
+      if(!best || entry.framerate < best->framerate) {
+        best = &entry;
+      }
+    }
+
+    return best;
+  }
+
+  /**
+   * True if the tuning has a resolution and framerate at which videoFormat keeps up
+   */
+  bool keeps_up(int videoFormat) const {
+    return std::any_of(std::begin(_entries), std::end(_entries), [videoFormat](const entry_t &entry) {
+      return entry.videoFormat == videoFormat && entry.keeps_up;
+    });
+  }
+
+private:
+  std::vector<entry_t> _entries;
+};
+
+static tuning_t tuning;
+
+/**
+ * libx265 ignores the threads and slices of the context, pass them on in x265-params.
+ * Wavefront parallel processing spreads the rows of a frame over the threads,
+ * with a single frame thread no frames are buffered in the encoder.
+ */
+void x265_params(AVCodecContext *ctx, AVDictionary **options) {
+  // The threads and slices from the options would only be applied when the codec is opened
+  av_opt_set_dict(ctx, options);
+
+  std::stringstream ss;
+  if(auto params = av_dict_get(*options, "x265-params", nullptr, 0)) {
+    ss << params->value << ':';
+  }
+  ss << "wpp=1:frame-threads=1:pools="sv << std::max(ctx->thread_count, 1) << ":slices="sv << std::max(ctx->slices, 1);
+
+  av_dict_set(options, "x265-params", ss.str().c_str(), 0);
+}
+
+/**
+ * overrides --> Options applied after those of the encoder, replacing options with the same name
+ */
+std::optional<session_t> make_session(
+  const encoder_t &encoder, const config_t &config, int width, int height, std::shared_ptr<platf::hwdevice_t> &&hwdevice,
+  const std::vector<encoder_t::option_t> &overrides = {}) {
   bool hardware = encoder.dev_type != AV_HWDEVICE_TYPE_NONE;
 
   auto &video_format = config.videoFormat == 0 ? encoder.h264 : encoder.hevc;
@@ -903,7 +1826,8 @@ std::optional<session_t> make_session(const encoder_t &encoder, const config_t &
     // Clients will request for the fewest slices per frame to get the
     // most efficient encode, but we may want to provide more slices than
     // requested to ensure we have enough parallelism for good performance.
-    ctx->slices = std::max(config.slicesPerFrame, config::video.min_threads);
+    auto tuned  = tuning.find(config);
+    ctx->slices = std::max(config.slicesPerFrame, tuned ? tuned->threads : config::video.min_threads);
   }
 
   if(!video_format[encoder_t::SLICE]) {
@@ -929,12 +1853,20 @@ std::optional<session_t> make_session(const encoder_t &encoder, const config_t &
     handle_option(option);
   }
 
+  if(auto tuned = hardware ? nullptr : tuning.find(config)) {
+    handle_option({ "preset"s, tuned->preset });
+  }
+
+  for(auto &option : overrides) {
+    handle_option(option);
+  }
+
+  if(video_format.name == "libx265"sv) {
+    x265_params(ctx.get(), &options);
+  }
+
   if(video_format[encoder_t::CBR]) {
-    auto bitrate        = config.bitrate * 1000;
-    ctx->rc_max_rate    = bitrate;
-    ctx->rc_buffer_size = bitrate / config.framerate;
-    ctx->bit_rate       = bitrate;
-    ctx->rc_min_rate    = bitrate;
+    set_bitrate(ctx.get(), config);
   }
   else if(video_format.qp) {
     handle_option(*video_format.qp);
@@ -969,7 +1901,16 @@ std::optional<session_t> make_session(const encoder_t &encoder, const config_t &
   if(!hwdevice->data) {
     auto device_tmp = std::make_unique<swdevice_t>();
 
-    if(device_tmp->init(width, height, frame.get(), sw_fmt)) {
+    auto convert_threads = config::video.convert_threads;
+    if(convert_threads <= 0) {
+      // The slice threads of the encoder run at the same time, use the cores left over
+      convert_threads = std::max(1, (int)std::thread::hardware_concurrency() - ctx->thread_count);
+    }
+
+    // The encoding thread takes part in the conversion
+    convert_threads = std::min(convert_threads, task_pool.size() + 1);
+
+    if(device_tmp->init(width, height, frame.get(), sw_fmt, convert_threads)) {
       return std::nullopt;
     }
 
@@ -1002,70 +1943,782 @@ std::optional<session_t> make_session(const encoder_t &encoder, const config_t &
   return std::make_optional(std::move(session));
 }
 
-void encode_run(
-  int &frame_nr, // Store progress of the frame number
-  safe::mail_t mail,
-  img_event_t images,
-  config_t config,
-  int width, int height,
-  std::shared_ptr<platf::hwdevice_t> &&hwdevice,
-  safe::signal_t &reinit_event,
-  const encoder_t &encoder,
-  void *channel_data) {
+/**
+ * WxH --> width and height, std::nullopt if resolution isn't of that form
+ */
+std::optional<std::pair<int, int>> parse_resolution(std::string_view resolution) {
+  auto middle = resolution.find('x');
+  if(middle == 0 || middle == std::string_view::npos || middle + 1 == resolution.size()) {
+    return std::nullopt;
+  }
 
-  auto session = make_session(encoder, config, width, height, std::move(hwdevice));
-  if(!session) {
-    return;
+  auto width  = (int)util::from_view(resolution.substr(0, middle));
+  auto height = (int)util::from_view(resolution.substr(middle + 1));
+  if(width <= 0 || height <= 0) {
+    return std::nullopt;
   }
 
-  auto frame = session->device->frame;
+  return std::make_pair(width, height);
+}
 
-  auto shutdown_event = mail->event<bool>(mail::shutdown);
-  auto packets        = mail::man->queue<packet_t>(mail::video_packets);
-  auto idr_events     = mail->event<bool>(mail::idr);
+/**
+ * Keeps the sessions of ended streams open, so that a stream with the same parameters skips opening the encoder.
+ *
+ * Only software sessions are kept, a hardware session belongs to the display it was made for.
+ * A session is only kept if the encoder holds no frames of its previous stream.
+ */
+class session_cache_t {
+public:
+  struct key_t {
+    const encoder_t *encoder;
+    config_t config;
 
-  while(true) {
-    if(shutdown_event->peek() || reinit_event.peek() || !images->running()) {
-      break;
+    // The dimensions of the images, the display scaled to fit the stream
+    int width, height;
+
+    bool operator==(const key_t &other) const {
+      auto &l = config;
+      auto &r = other.config;
+
+      // libx264 picks up a new bitrate on the next frame, the other encoders only read it when opened
+      auto bitrate = l.videoFormat == 0 || l.bitrate == r.bitrate;
+
+      return bitrate &&
+             std::tie(encoder, width, height, l.width, l.height, l.framerate, l.slicesPerFrame, l.numRefFrames, l.encoderCscMode, l.videoFormat, l.dynamicRange) ==
+               std::tie(other.encoder, other.width, other.height, r.width, r.height, r.framerate, r.slicesPerFrame, r.numRefFrames, r.encoderCscMode, r.videoFormat, r.dynamicRange);
     }
+  };
 
-    if(idr_events->peek()) {
-      frame->pict_type = AV_PICTURE_TYPE_I;
-      frame->key_frame = 1;
+  /**
+   * Returns an idle session for config, removing it from the cache
+   */
+  std::optional<session_t> take(const encoder_t &encoder, const config_t &config, int width, int height) {
+    key_t key { &encoder, config, width, height };
 
-      idr_events->pop();
+    std::lock_guard lg { lock };
+
+    auto pos = std::find_if(std::begin(entries), std::end(entries), [&key](const entry_t &entry) {
+      return entry.key == key;
+    });
+
+    if(pos == std::end(entries)) {
+      return std::nullopt;
     }
 
-    if(!frame->key_frame || images->peek()) {
-      if(auto img = images->pop(100ms)) {
-        session->device->convert(*img);
-      }
-      else if(images->running()) {
-        continue;
-      }
-      else {
-        break;
-      }
+    auto session = std::move(pos->session);
+    entries.erase(pos);
+
+    auto &video_format = config.videoFormat == 0 ? encoder.h264 : encoder.hevc;
+    if(video_format[encoder_t::CBR]) {
+      set_bitrate(session.ctx.get(), config);
     }
 
-    if(encode(frame_nr++, *session, frame, packets, channel_data)) {
-      BOOST_LOG(error) << "Could not encode video packet"sv;
+    return std::make_optional(std::move(session));
+  }
+
+  /**
+   * Keep session for the next stream with the same parameters, the least recently used session is dropped when the cache is full
+   */
+  void put(const encoder_t &encoder, const config_t &config, int width, int height, session_t &&session) {
+    if(config::video.warm_sessions <= 0 || encoder.dev_type != AV_HWDEVICE_TYPE_NONE) {
       return;
     }
 
-    frame->pict_type = AV_PICTURE_TYPE_NONE;
-    frame->key_frame = 0;
-  }
-}
+    // Another session may still convert into the frames of the device
+    auto device = dynamic_cast<swdevice_t *>(session.device.get());
+    if(!device || session.device.use_count() > 1) {
+      return;
+    }
 
-input::touch_port_t make_port(platf::display_t *display, const config_t &config) {
-  float wd = display->width;
-  float hd = display->height;
+    if(session.in_flight) {
+      if(!(session.ctx->codec->capabilities & AV_CODEC_CAP_ENCODER_FLUSH)) {
+        return;
+      }
 
-  float wt = config.width;
-  float ht = config.height;
+      avcodec_flush_buffers(session.ctx.get());
+      session.in_flight = 0;
+    }
 
-  auto scalar = std::fminf(wt / wd, ht / hd);
+    device->reset();
+    session.pts_offset = session.next_pts;
+
+    // Destroyed outside the lock
+    std::vector<entry_t> dropped;
+    {
+      std::lock_guard lg { lock };
+
+      entries.insert(std::begin(entries), entry_t { key_t { &encoder, config, width, height }, std::move(session) });
+
+      while((int)entries.size() > config::video.warm_sessions) {
+        dropped.emplace_back(std::move(entries.back()));
+        entries.pop_back();
+      }
+    }
+  }
+
+  /**
+   * Open sessions for the resolutions and framerates advertised to clients, so the first stream is quick as well.
+   * The combinations closest to the resolution of the display at 60 fps go first.
+   */
+  void prewarm(const encoder_t &encoder) {
+    if(config::video.warm_sessions <= 0 || encoder.dev_type != AV_HWDEVICE_TYPE_NONE) {
+      return;
+    }
+
+    std::shared_ptr<platf::display_t> disp;
+    reset_display(disp, encoder.dev_type, config::video.output_name, 60);
+    if(!disp) {
+      return;
+    }
+
+    // The parameters other than the dimensions and framerate are a guess at what clients commonly ask for
+    std::vector<config_t> configs;
+    for(auto &resolution : config::nvhttp.resolutions) {
+      auto size = parse_resolution(resolution);
+      if(!size) {
+        continue;
+      }
+
+      auto [width, height] = *size;
+      for(auto fps : config::nvhttp.fps) {
+        configs.emplace_back(config_t { width, height, fps, 10000, 1, 1, 0, 0, 0 });
+      }
+    }
+
+    auto distance = [pixels = disp->width * disp->height](const config_t &config) {
+      return std::make_pair(std::abs(config.width * config.height - pixels), std::abs(config.framerate - 60));
+    };
+
+    std::sort(std::begin(configs), std::end(configs), [&distance](const config_t &l, const config_t &r) {
+      return distance(l) < distance(r);
+    });
+
+    configs.resize(std::min<std::size_t>(configs.size(), config::video.warm_sessions));
+
+    // put() places each session in front, the best match should end up first
+    std::for_each(std::rbegin(configs), std::rend(configs), [&](const config_t &config) {
+      auto begin = std::chrono::steady_clock::now();
+
+      // The capture thread scales the display to a session on its own, the session is looked up by the size of those images
+      disp->scale_to(config.width, config.height);
+      auto [width, height] = disp->img_size();
+
+      auto hwdevice = disp->make_hwdevice(map_pix_fmt(encoder.static_pix_fmt));
+      if(!hwdevice) {
+        return;
+      }
+
+      auto session = make_session(encoder, config, width, height, std::move(hwdevice));
+      if(!session) {
+        return;
+      }
+
+      BOOST_LOG(info)
+        << "Prewarmed encoder for "sv << config.width << 'x' << config.height << 'x' << config.framerate
+        << " in "sv << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin).count() << "ms"sv;
+
+      put(encoder, config, width, height, std::move(*session));
+    });
+  }
+
+private:
+  struct entry_t {
+    key_t key;
+    session_t session;
+  };
+
+  std::mutex lock;
+
+  // Most recently used first
+  std::vector<entry_t> entries;
+};
+
+static session_cache_t session_cache;
+
+static cpu_budget_t cpu_budget;
+
+struct reservation_t {
+  cpu_budget_t::lease_t lease;
+};
+
+/**
+ * The encoder threads make_session gives a software session for config
+ */
+int sw_threads(const encoder_t &encoder, const config_t &config) {
+  auto &video_format = config.videoFormat == 0 ? encoder.h264 : encoder.hevc;
+  if(!video_format[encoder_t::SLICE]) {
+    return 1;
+  }
+
+  auto tuned = tuning.find(config);
+  return std::max(config.slicesPerFrame, tuned ? tuned->threads : config::video.min_threads);
+}
+
+/**
+ * The interval between frames repeated while the captured image doesn't change,
+ * zero when nothing should be sent
+ */
+std::chrono::nanoseconds idle_frame_delay() {
+  if(config::video.idle_fps <= 0) {
+    return 0ns;
+  }
+
+  return std::chrono::nanoseconds { 1s } / config::video.idle_fps;
+}
+
+/**
+ * Converts the captured images for all sessions of the async capture whose frames have the same format.
+ * Each image is converted once, the sessions encode references to the converted frame.
+ */
+class shared_convert_t {
+public:
+  struct key_t {
+    int in_width, in_height;
+    int width, height;
+    AVPixelFormat format;
+    AVColorSpace colorspace;
+    AVColorRange color_range;
+
+    bool operator==(const key_t &other) const {
+      return std::tie(in_width, in_height, width, height, format, colorspace, color_range) ==
+             std::tie(other.in_width, other.in_height, other.width, other.height, other.format, other.colorspace, other.color_range);
+    }
+  };
+
+  shared_convert_t(const key_t &key, std::shared_ptr<swdevice_t> &&device) : key { key }, device { std::move(device) } {}
+
+  /**
+   * Returns the conversion shared by the sessions with the same key.
+   * If there is none yet, device becomes the converter of a new one.
+   *
+   * Returns nullptr if device can't convert without blocking its encoder
+   */
+  static std::shared_ptr<shared_convert_t> get(const key_t &key, std::shared_ptr<swdevice_t> &&device) {
+    static std::mutex lock;
+    static std::vector<std::weak_ptr<shared_convert_t>> converts;
+
+    std::lock_guard lg { lock };
+
+    KITTY_WHILE_LOOP(auto pos = std::begin(converts), pos != std::end(converts), {
+      auto convert = pos->lock();
+
+      // The last session using it has ended
+      if(!convert) {
+        pos = converts.erase(pos);
+        continue;
+      }
+
+      if(convert->key == key) {
+        return convert;
+      }
+
+      ++pos;
+    })
+
+    // The sessions hold on to frames while encoding them
+    if(device->buffer(PIPELINE_FRAMES)) {
+      return nullptr;
+    }
+
+    auto convert = std::make_shared<shared_convert_t>(key, std::move(device));
+    converts.emplace_back(convert);
+
+    return convert;
+  }
+
+  /**
+   * Returns a reference to the frame holding img, nullptr on failure
+   */
+  frame_t convert(platf::img_t &img) {
+    std::lock_guard lg { lock };
+
+    // The capture thread reuses images, but each changed image gets a new capture_seq
+    if(!img.capture_seq || &img != last_img || img.capture_seq != last_seq) {
+      last_img = nullptr;
+      if(device->convert(img)) {
+        return nullptr;
+      }
+
+      last_img = &img;
+      last_seq = img.capture_seq;
+    }
+
+    return frame_t { av_frame_clone(device->frame) };
+  }
+
+  const key_t key;
+
+private:
+  std::mutex lock;
+  std::shared_ptr<swdevice_t> device;
+
+  // The image in device->frame
+  const platf::img_t *last_img {};
+  std::uint64_t last_seq {};
+};
+
+/**
+ * Steps a software session down while encoding a frame takes longer than the frame interval,
+ * and back up once there is headroom again.
+ *
+ * The steps, in order: faster presets, more slices, then a lower resolution which the client scales up.
+ * Each level is a new session, the stream continues with a keyframe.
+ */
+class overload_t {
+public:
+  struct level_t {
+    // Empty for the preset the session starts with
+    std::string preset;
+
+    int slices;
+    int width, height;
+  };
+
+  overload_t(const encoder_t &encoder, const config_t &config) : _config { config } {
+    using namespace std::literals;
+
+    _budget      = std::chrono::nanoseconds { 1s } / std::max(config.framerate, 1);
+    _next_window = std::chrono::steady_clock::now() + 1s;
+    _next_report = _next_window + 9s;
+
+    _levels.emplace_back(level_t { {}, config.slicesPerFrame, config.width, config.height });
+
+    if(config::video.overload_control <= 0 || encoder.dev_type != AV_HWDEVICE_TYPE_NONE) {
+      return;
+    }
+
+    // libx264 and libx265 share their presets
+    static const std::vector<std::string_view> presets {
+      "ultrafast"sv, "superfast"sv, "veryfast"sv, "faster"sv, "fast"sv, "medium"sv, "slow"sv, "slower"sv, "veryslow"sv, "placebo"sv
+    };
+
+    auto tuned = tuning.find(config);
+    _preset    = tuned ? tuned->preset : config::video.sw.preset;
+
+    auto preset = std::find(std::begin(presets), std::end(presets), _preset);
+    while(preset != std::end(presets) && preset != std::begin(presets)) {
+      --preset;
+
+      auto level   = _levels.back();
+      level.preset = *preset;
+
+      _levels.emplace_back(std::move(level));
+    }
+
+    auto &video_format = config.videoFormat == 0 ? encoder.h264 : encoder.hevc;
+    auto cores         = (int)std::thread::hardware_concurrency();
+    if(video_format[encoder_t::SLICE] && cores > sw_threads(encoder, config)) {
+      auto level   = _levels.back();
+      level.slices = cores;
+
+      _levels.emplace_back(std::move(level));
+    }
+
+    if(config::video.overload_control >= 2) {
+      for(auto [num, den] : { std::make_pair(3, 4), std::make_pair(1, 2) }) {
+        auto level   = _levels.back();
+        level.width  = (config.width * num / den) & ~1;
+        level.height = (config.height * num / den) & ~1;
+
+        _levels.emplace_back(std::move(level));
+      }
+    }
+  }
+
+  /**
+   * The stream parameters of the current level
+   */
+  config_t config() const {
+    auto config = _config;
+
+    auto &level           = _levels[_level];
+    config.slicesPerFrame = level.slices;
+    config.width          = level.width;
+    config.height         = level.height;
+
+    return config;
+  }
+
+  /**
+   * The encoder options of the current level
+   */
+  std::vector<encoder_t::option_t> options() const {
+    std::vector<encoder_t::option_t> options;
+
+    auto &level = _levels[_level];
+    if(!level.preset.empty()) {
+      options.emplace_back("preset"s, level.preset);
+    }
+
+    return options;
+  }
+
+  int level() const {
+    return _level;
+  }
+
+  /**
+   * Record how long encoding a frame took.
+   * Returns true if the level changed, the session must be made anew
+   */
+  bool update(std::chrono::nanoseconds encode_time) {
+    using namespace std::literals;
+
+    _window.total += encode_time;
+    ++_window.frames;
+
+    _stats.total += encode_time;
+    _stats.max = std::max(_stats.max, encode_time);
+    ++_stats.frames;
+
+    auto now = std::chrono::steady_clock::now();
+    if(now >= _next_report) {
+      report(now);
+    }
+
+    if(now < _next_window) {
+      return false;
+    }
+
+    auto load = std::chrono::duration<double>(_window.total / _window.frames) / _budget;
+
+    _window      = {};
+    _next_window = now + 1s;
+
+    _overloaded = load > 0.9 ? _overloaded + 1 : 0;
+    _headroom   = load < 0.5 ? _headroom + 1 : 0;
+
+    // Two overloaded seconds in a row step down
+    if(_overloaded >= 2 && _level + 1 < (int)_levels.size()) {
+      // Stepping back up was premature, wait longer before the next attempt
+      if(now - _last_step_up < 30s) {
+        _hold = std::min(_hold * 2, 300);
+      }
+
+      change(_level + 1, load);
+      return true;
+    }
+
+    if(_headroom >= _hold && _level > 0) {
+      _last_step_up = now;
+
+      change(_level - 1, load);
+      return true;
+    }
+
+    return false;
+  }
+
+private:
+  void change(int level, double load) {
+    BOOST_LOG(info)
+      << "Encoding used "sv << (int)(load * 100) << "% of the frame interval, "sv
+      << (level > _level ? "stepping down"sv : "stepping up"sv) << " to level "sv << level << '/' << _levels.size() - 1 << ": "sv
+      << describe(_levels[level]);
+
+    _level      = level;
+    _overloaded = 0;
+    _headroom   = 0;
+
+    ++_stats.transitions;
+  }
+
+  std::string describe(const level_t &level) const {
+    std::stringstream ss;
+    ss
+      << "preset "sv << (level.preset.empty() ? _preset : level.preset)
+      << ", "sv << level.slices << " slices, "sv << level.width << 'x' << level.height;
+
+    return ss.str();
+  }
+
+  /**
+   * Every 10 seconds, log the encode time against the budget
+   */
+  void report(std::chrono::steady_clock::time_point now) {
+    using namespace std::literals;
+
+    if(_stats.frames) {
+      BOOST_LOG(debug)
+        << "Encode time: average "sv << std::chrono::duration<double, std::milli>(_stats.total / _stats.frames).count()
+        << "ms, max "sv << std::chrono::duration<double, std::milli>(_stats.max).count()
+        << "ms, budget "sv << std::chrono::duration<double, std::milli>(_budget).count()
+        << "ms, level "sv << _level << ", "sv << _stats.transitions << " level changes"sv;
+    }
+
+    _stats       = {};
+    _next_report = now + 10s;
+  }
+
+  config_t _config;
+  std::vector<level_t> _levels;
+
+  // The preset of the first level
+  std::string _preset;
+
+  int _level {};
+
+  std::chrono::nanoseconds _budget;
+
+  // Consecutive seconds over and well under the budget
+  int _overloaded {};
+  int _headroom {};
+
+  // Seconds of headroom needed to step back up
+  int _hold { 10 };
+  std::chrono::steady_clock::time_point _last_step_up;
+
+  struct {
+    std::chrono::nanoseconds total;
+    int frames;
+  } _window {};
+  std::chrono::steady_clock::time_point _next_window;
+
+  struct {
+    std::chrono::nanoseconds total;
+    std::chrono::nanoseconds max;
+    int frames;
+    int transitions;
+  } _stats {};
+  std::chrono::steady_clock::time_point _next_report;
+};
+
+void encode_run(
+  int &frame_nr, // Store progress of the frame number
+  safe::mail_t mail,
+  img_event_t images,
+  config_t config,
+  int width, int height,
+  std::shared_ptr<platf::hwdevice_t> &&hwdevice,
+  safe::signal_t &reinit_event,
+  const encoder_t &encoder,
+  overload_t &overload,
+  cpu_budget_t::lease_t *lease,
+  std::optional<std::chrono::steady_clock::time_point> switched,
+  std::shared_ptr<platf::img_t> &last_img, // The last image converted, a remade session starts from it
+  safe::mail_raw_t::queue_t<packet_t> packets,
+  void *channel_data) {
+
+  auto begin = switched.value_or(std::chrono::steady_clock::now());
+
+  auto options = overload.options();
+
+  auto threads = lease ? lease->threads() : 0;
+  if(lease && lease->limited()) {
+    // avcodec_open2 applies these over the threads and slices derived from the config
+    options.emplace_back("threads"s, threads);
+    options.emplace_back("slices"s, std::max(config.slicesPerFrame, threads));
+  }
+
+  // The cache doesn't know about the options of the overload levels or the CPU budget
+  auto cache = overload.level() == 0 && !(lease && lease->limited());
+
+  std::optional<session_t> session;
+  if(cache) {
+    session = session_cache.take(encoder, config, width, height);
+  }
+
+  auto warm = (bool)session;
+  if(!session) {
+    session = make_session(encoder, config, width, height, std::move(hwdevice), options);
+  }
+
+  if(!session) {
+    return;
+  }
+
+  auto frame = session->device->frame;
+
+  auto shutdown_event       = mail->event<bool>(mail::shutdown);
+  auto switch_display_event = mail->event<int>(mail::switch_display);
+  auto idr_events           = mail->event<bool>(mail::idr);
+
+  // Images are only raised when the screen changed, repeat the last frame meanwhile
+  auto idle_delay      = idle_frame_delay();
+  auto timeout         = idle_delay.count() ? std::min<std::chrono::nanoseconds>(idle_delay, 100ms) : 100ms;
+  auto next_idle_frame = std::chrono::steady_clock::now() + idle_delay;
+
+  // The display was reinitialized with other dimensions, capture_async remakes the session to match.
+  // The image is handed back, so the remade session starts from it
+  auto resized = [&, sw = encoder.dev_type == AV_HWDEVICE_TYPE_NONE](std::shared_ptr<platf::img_t> &img) {
+    if(!sw || (img->width == width && img->height == height)) {
+      return false;
+    }
+
+    BOOST_LOG(info) << "Captured images changed from "sv << width << 'x' << height << " to "sv << img->width << 'x' << img->height << ", remaking the encoder"sv;
+
+    images->raise(std::move(img));
+    return true;
+  };
+
+  // Converted frames waiting for the encoder
+  safe::queue_t<frame_t> converted { PIPELINE_FRAMES - 2, safe::overflow_e::block, "video::converted" };
+
+  // Holds the frame being encoded when it comes from converted
+  frame_t current;
+
+  // Software frames are converted on a separate thread, while the previous frame is being encoded
+  std::thread convert_thread;
+  if(auto device = std::dynamic_pointer_cast<swdevice_t>(session->device)) {
+    auto &ctx = session->ctx;
+
+    shared_convert_t::key_t key {
+      width, height,
+      ctx->width, ctx->height,
+      ctx->pix_fmt,
+      ctx->colorspace, ctx->color_range
+    };
+
+    if(auto shared = shared_convert_t::get(key, std::move(device))) {
+      convert_thread = std::thread { [&converted, &images, &resized, &last_img, shared = std::move(shared)]() {
+        while(converted.running()) {
+          auto img = images->pop(100ms);
+          if(!img) {
+            if(!images->running()) {
+              break;
+            }
+
+            continue;
+          }
+
+          if(resized(*img)) {
+            break;
+          }
+
+          if(auto frame = shared->convert(*img)) {
+            converted.raise(std::move(frame));
+          }
+
+          // Read once the thread has been joined
+          last_img = std::move(*img);
+        }
+
+        converted.stop();
+      } };
+
+      // Other sessions may convert into the shared frames while this session still encodes its first frame
+      current.reset(av_frame_clone(frame));
+      frame = current.get();
+    }
+  }
+
+  auto fg = util::fail_guard([&]() {
+    converted.stop();
+
+    if(convert_thread.joinable()) {
+      convert_thread.join();
+    }
+  });
+
+  // Applies to the next frame that gets encoded
+  bool idr = false;
+
+  // A reused encoder doesn't start the stream with a keyframe by itself
+  bool first_frame = true;
+
+  while(true) {
+    if(shutdown_event->peek() || switch_display_event->peek() || reinit_event.peek() || !images->running()) {
+      break;
+    }
+
+    if(idr_events->peek()) {
+      idr = true;
+
+      idr_events->pop();
+    }
+
+    if(convert_thread.joinable()) {
+      if(!idr || converted.peek()) {
+        if(auto next = converted.pop(timeout)) {
+          current = std::move(next);
+          frame   = current.get();
+        }
+        else if(!converted.running()) {
+          break;
+        }
+        else if(!idle_delay.count() || std::chrono::steady_clock::now() < next_idle_frame) {
+          continue;
+        }
+      }
+    }
+    else if(!idr || images->peek()) {
+      if(auto img = images->pop(timeout)) {
+        if(resized(*img)) {
+          break;
+        }
+
+        session->device->convert(*img);
+
+        last_img = std::move(*img);
+      }
+      else if(!images->running()) {
+        break;
+      }
+      else if(!idle_delay.count() || std::chrono::steady_clock::now() < next_idle_frame) {
+        continue;
+      }
+    }
+
+    if(idr || first_frame) {
+      frame->pict_type = AV_PICTURE_TYPE_I;
+      frame->key_frame = 1;
+    }
+
+    auto encode_begin = std::chrono::steady_clock::now();
+    if(encode(frame_nr++, *session, frame, packets, channel_data)) {
+      BOOST_LOG(error) << "Could not encode video packet"sv;
+      return;
+    }
+    auto encode_end = std::chrono::steady_clock::now();
+
+    frame->pict_type = AV_PICTURE_TYPE_NONE;
+    frame->key_frame = 0;
+
+    idr             = false;
+    next_idle_frame = encode_end + idle_delay;
+
+    if(first_frame) {
+      first_frame = false;
+
+      BOOST_LOG(info)
+        << (switched ? "Time to first frame after switching displays: "sv : "Time to first frame: "sv)
+        << std::chrono::duration_cast<std::chrono::milliseconds>(encode_end - begin).count()
+        << "ms, "sv << (warm ? "reused encoder"sv : "new encoder"sv);
+    }
+
+    // capture_async makes the session of the new level
+    if(overload.update(encode_end - encode_begin)) {
+      break;
+    }
+
+    // The share of the cores changed when another session started or ended
+    if(lease && lease->threads() != threads) {
+      break;
+    }
+  }
+
+  // The conversion may hold on to the device until the convert thread has ended
+  fg.disable();
+  converted.stop();
+  if(convert_thread.joinable()) {
+    convert_thread.join();
+  }
+
+  current.reset();
+
+  if(cache) {
+    session_cache.put(encoder, config, width, height, std::move(*session));
+  }
+}
+
+input::touch_port_t make_port(platf::display_t *display, const config_t &config) {
+  float wd = display->width;
+  float hd = display->height;
+
+  float wt = config.width;
+  float ht = config.height;
+
+  auto scalar = std::fminf(wt / wd, ht / hd);
 
   auto w2 = scalar * wd;
   auto h2 = scalar * hd;
@@ -1163,6 +2816,10 @@ encode_e encode_run_sync(
     return encode_e::error;
   }
 
+  auto idle_delay = idle_frame_delay();
+
+  std::uint64_t capture_seq = 0;
+
   std::vector<sync_session_t> synced_sessions;
   for(auto &ctx : synced_session_ctxs) {
     auto synced_session = make_synced_session(disp.get(), encoder, *img, *ctx);
@@ -1173,9 +2830,16 @@ encode_e encode_run_sync(
     synced_sessions.emplace_back(std::move(*synced_session));
   }
 
+  // The sessions with a frame to encode for the current image
+  std::vector<sync_session_t *> pending;
+
   auto ec = platf::capture_e::ok;
   while(encode_session_ctx_queue.running()) {
     auto snapshot_cb = [&](std::shared_ptr<platf::img_t> &img) -> std::shared_ptr<platf::img_t> {
+      if(!img->unchanged) {
+        img->capture_seq = ++capture_seq;
+      }
+
       while(encode_session_ctx_queue.peek()) {
         auto encode_session_ctx = encode_session_ctx_queue.pop();
         if(!encode_session_ctx) {
@@ -1193,6 +2857,9 @@ encode_e encode_run_sync(
         synced_sessions.emplace_back(std::move(*encode_session));
       }
 
+      auto now = std::chrono::steady_clock::now();
+
+      pending.clear();
       KITTY_WHILE_LOOP(auto pos = std::begin(synced_sessions), pos != std::end(synced_sessions), {
         auto frame = pos->session.device->frame;
         auto ctx   = pos->ctx;
@@ -1219,25 +2886,46 @@ encode_e encode_run_sync(
           ctx->idr_events->pop();
         }
 
-        if(pos->session.device->convert(*img)) {
-          BOOST_LOG(error) << "Could not convert image"sv;
-          ctx->shutdown_event->raise(true);
-
+        if(img->unchanged && pos->converted && !frame->key_frame && (!idle_delay.count() || now < pos->next_idle_frame)) {
+          ++pos;
           continue;
         }
 
+        // The devices of a display may share a GPU context, only the encoding runs in parallel
+        if(!img->unchanged || !pos->converted) {
+          if(pos->session.device->convert(*img)) {
+            BOOST_LOG(error) << "Could not convert image"sv;
+            ctx->shutdown_event->raise(true);
+
+            continue;
+          }
+
+          pos->converted = true;
+        }
+
+        pending.emplace_back(&*pos);
+
+        ++pos;
+      })
+
+      // The sessions don't share any state, img is only handed back once every session is done with it
+      task_pool.parallel_for((int)pending.size(), [&](int x) {
+        auto pos   = pending[x];
+        auto frame = pos->session.device->frame;
+        auto ctx   = pos->ctx;
+
         if(encode(ctx->frame_nr++, pos->session, frame, ctx->packets, ctx->channel_data)) {
           BOOST_LOG(error) << "Could not encode video packet"sv;
           ctx->shutdown_event->raise(true);
 
-          continue;
+          return;
         }
 
         frame->pict_type = AV_PICTURE_TYPE_NONE;
         frame->key_frame = 0;
 
-        ++pos;
-      })
+        pos->next_idle_frame = now + idle_delay;
+      });
 
       if(switch_display_event->peek()) {
         ec = platf::capture_e::reinit;
@@ -1267,30 +2955,271 @@ void captureThreadSync() {
 
   std::vector<std::unique_ptr<sync_session_ctx_t>> synced_session_ctxs;
 
-  auto &ctx = ref->encode_session_ctx_queue;
-  auto lg   = util::fail_guard([&]() {
-    ctx.stop();
+  auto &ctx = ref->encode_session_ctx_queue;
+  auto lg   = util::fail_guard([&]() {
+    ctx.stop();
+
+    for(auto &ctx : synced_session_ctxs) {
+      ctx->shutdown_event->raise(true);
+      ctx->join_event->raise(true);
+    }
+
+    for(auto &ctx : ctx.drain()) {
+      ctx.shutdown_event->raise(true);
+      ctx.join_event->raise(true);
+    }
+  });
+
+  while(encode_run_sync(synced_session_ctxs, ctx) == encode_e::reinit) {}
+}
+
+void capture_async(
+  safe::mail_t mail,
+  config_t &config,
+  std::string display_name,
+  safe::mail_raw_t::queue_t<packet_t> packets,
+  std::shared_ptr<reservation_t> reservation,
+  void *channel_data);
+
+/**
+ * An encoder shared by the async sessions with the same stream parameters.
+ * It captures and encodes like a session of its own, its packets are copied to every subscribed session.
+ */
+class shared_encode_t {
+public:
+  /**
+   * The replacements of a subscriber, with copies of the bytes they refer to.
+   * The packets copied for the subscriber share it, they may still be queued after the encoder is gone
+   */
+  struct replacements_t {
+    explicit replacements_t(const std::vector<packet_raw_t::replace_t> &source) {
+      // The views point into the strings, they mustn't move
+      bytes.reserve(source.size() * 2);
+
+      for(auto &replacement : source) {
+        auto &old  = bytes.emplace_back(replacement.old);
+        auto &_new = bytes.emplace_back(replacement._new);
+
+        replacements.emplace_back(old, _new);
+      }
+    }
+
+    bool matches(const std::vector<packet_raw_t::replace_t> &source) const {
+      return std::equal(std::begin(replacements), std::end(replacements), std::begin(source), std::end(source), [](auto &l, auto &r) {
+        return l.old == r.old && l._new == r._new;
+      });
+    }
+
+    std::vector<std::string> bytes;
+    std::vector<packet_raw_t::replace_t> replacements;
+  };
+
+  struct subscriber_t {
+    void *channel_data;
+
+    // The frame number of the subscribed session
+    int *frame_nr;
+
+    // A session only receives packets from the first keyframe onward
+    bool started;
+
+    std::shared_ptr<replacements_t> replacements;
+  };
+
+  shared_encode_t(const config_t &config, const std::string &display_name, int width, int height)
+      : config { config }, display_name { display_name }, width { width }, height { height }, mail { mail::make() } {
+    packets = mail->queue<packet_t>(mail::video_packets);
+  }
+
+  ~shared_encode_t() {
+    mail->event<bool>(mail::shutdown)->raise(true);
+
+    if(capture_thread.joinable()) {
+      capture_thread.join();
+    }
+
+    if(fan_out_thread.joinable()) {
+      fan_out_thread.join();
+    }
+  }
+
+  /**
+   * Subscribe the session to the shared encoder for config and display_name, and forward its keyframe requests
+   * until the session ends or switches displays, the display is reinitialized or the shared encoder fails.
+   */
+  static void run(
+    int &frame_nr,
+    safe::mail_t mail,
+    img_event_t images,
+    const config_t &config,
+    const std::string &display_name,
+    int width, int height,
+    safe::signal_t &reinit_event,
+    std::shared_ptr<reservation_t> &reservation,
+    void *channel_data) {
+
+    auto shared = join(config, display_name, width, height, reservation, channel_data, frame_nr);
+    auto fg     = util::fail_guard([&]() {
+      leave(shared, channel_data);
+    });
+
+    auto shutdown_event       = mail->event<bool>(mail::shutdown);
+    auto switch_display_event = mail->event<int>(mail::switch_display);
+    auto idr_events           = mail->event<bool>(mail::idr);
+    auto shared_idr           = shared->mail->event<bool>(mail::idr);
+
+    while(!shutdown_event->peek() && !switch_display_event->peek() && !reinit_event.peek() && images->running() && shared->running) {
+      if(idr_events->peek()) {
+        shared_idr->raise(true);
+
+        idr_events->pop();
+      }
+
+      // The shared encoder has images of its own, don't keep the capture thread waiting for these
+      images->pop(100ms);
+    }
+  }
+
+private:
+  static std::shared_ptr<shared_encode_t> join(
+    const config_t &config, const std::string &display_name, int width, int height,
+    std::shared_ptr<reservation_t> &reservation, void *channel_data, int &frame_nr) {
+    std::lock_guard lg { registry_lock };
+
+    std::shared_ptr<shared_encode_t> shared;
+    for(auto &shared_p : registry) {
+      if(shared_p->running && shared_p->matches(config, display_name, width, height)) {
+        shared = shared_p;
+        break;
+      }
+    }
+
+    // The share reserved for the session goes to the encoder it starts, a running encoder has a share of its own
+    if(!shared) {
+      shared              = std::make_shared<shared_encode_t>(config, display_name, width, height);
+      shared->reservation = std::move(reservation);
+      shared->start();
+
+      registry.emplace_back(shared);
+
+      BOOST_LOG(info) << "Started a shared encoder for "sv << config.width << 'x' << config.height << 'x' << config.framerate;
+    }
+
+    reservation.reset();
+
+    {
+      std::lock_guard lg { shared->lock };
+      shared->subscribers.emplace_back(subscriber_t { channel_data, &frame_nr, false, nullptr });
+    }
+
+    // The new subscriber has to start with a keyframe
+    shared->mail->event<bool>(mail::idr)->raise(true);
+
+    return shared;
+  }
+
+  static void leave(std::shared_ptr<shared_encode_t> &shared, void *channel_data) {
+    std::lock_guard lg { registry_lock };
+
+    std::lock_guard lg_subscribers { shared->lock };
+
+    auto &subscribers = shared->subscribers;
+    subscribers.erase(std::find_if(std::begin(subscribers), std::end(subscribers), [channel_data](auto &subscriber) {
+      return subscriber.channel_data == channel_data;
+    }));
+
+    // The destructor of the last reference stops the encoder
+    if(subscribers.empty()) {
+      registry.erase(std::find(std::begin(registry), std::end(registry), shared));
+    }
+  }
+
+  bool matches(const config_t &config, const std::string &display_name, int width, int height) const {
+    auto &c = this->config;
+
+    return this->display_name == display_name && this->width == width && this->height == height &&
+           std::tie(c.width, c.height, c.framerate, c.bitrate, c.slicesPerFrame, c.numRefFrames, c.encoderCscMode, c.videoFormat, c.dynamicRange) ==
+             std::tie(config.width, config.height, config.framerate, config.bitrate, config.slicesPerFrame, config.numRefFrames, config.encoderCscMode, config.videoFormat, config.dynamicRange);
+  }
+
+  void start() {
+    capture_thread = std::thread { [this]() {
+      capture_async(mail, config, display_name, packets, std::move(reservation), nullptr);
+
+      running = false;
+      packets->stop();
+    } };
+
+    fan_out_thread = std::thread { [this]() {
+      auto video_packets = mail::man->queue<packet_t>(mail::video_packets);
+
+      while(auto packet = packets->pop()) {
+        std::lock_guard lg { lock };
+
+        for(auto &subscriber : subscribers) {
+          if(!subscriber.started && !(packet->flags & AV_PKT_FLAG_KEY)) {
+            continue;
+          }
+          subscriber.started = true;
+
+          // Every session numbers its own frames
+          auto copy = std::make_unique<packet_raw_t>(subscriber.channel_data);
+          av_packet_ref(copy.get(), packet.get());
+
+          copy->pts = (*subscriber.frame_nr)++;
+
+          // The replacements of the encoder change rarely, the subscriber copies them when they do
+          if(!subscriber.replacements || !subscriber.replacements->matches(*packet->replacements)) {
+            subscriber.replacements = std::make_shared<replacements_t>(*packet->replacements);
+          }
+
+          copy->replacements       = &subscriber.replacements->replacements;
+          copy->replacements_owner = subscriber.replacements;
+
+          video_packets->raise(std::move(copy));
+        }
+      }
+    } };
+  }
+
+  config_t config;
+  std::string display_name;
+  int width, height;
+
+  // The events and packets of the shared encoder
+  safe::mail_t mail;
+  safe::mail_raw_t::queue_t<packet_t> packets;
+
+  // The share reserved for the session that started the encoder, the encoder takes it over
+  std::shared_ptr<reservation_t> reservation;
+
+  std::atomic_bool running { true };
 
-    for(auto &ctx : synced_session_ctxs) {
-      ctx->shutdown_event->raise(true);
-      ctx->join_event->raise(true);
-    }
+  std::mutex lock;
+  std::vector<subscriber_t> subscribers;
 
-    for(auto &ctx : ctx.unsafe()) {
-      ctx.shutdown_event->raise(true);
-      ctx.join_event->raise(true);
-    }
-  });
+  std::thread capture_thread;
+  std::thread fan_out_thread;
 
-  while(encode_run_sync(synced_session_ctxs, ctx) == encode_e::reinit) {}
-}
+  static inline std::mutex registry_lock;
+  static inline std::vector<std::shared_ptr<shared_encode_t>> registry;
+};
 
+/**
+ * display_name --> The display captured first, the session switches displays with mail::switch_display
+ * packets --> Where the encoded video is sent
+ * channel_data --> nullptr for the capture of a shared encoder, whose packets are copied to its subscribers
+ */
 void capture_async(
   safe::mail_t mail,
   config_t &config,
+  std::string display_name,
+  safe::mail_raw_t::queue_t<packet_t> packets,
+  std::shared_ptr<reservation_t> reservation,
   void *channel_data) {
 
-  auto shutdown_event = mail->event<bool>(mail::shutdown);
+  auto shutdown_event       = mail->event<bool>(mail::shutdown);
+  auto switch_display_event = mail->event<int>(mail::switch_display);
 
   auto images = std::make_shared<img_event_t::element_type>();
   auto lg     = util::fail_guard([&]() {
@@ -1298,13 +3227,13 @@ void capture_async(
     shutdown_event->raise(true);
   });
 
-  auto ref = capture_thread_async.ref();
+  auto ref = capture_threads_async.ref(display_name);
   if(!ref) {
     return;
   }
 
   ref->capture_ctx_queue->raise(capture_ctx_t {
-    images, config.framerate });
+    images, config.framerate, config.width, config.height });
 
   if(!ref->capture_ctx_queue->running()) {
     return;
@@ -1314,23 +3243,109 @@ void capture_async(
 
   auto touch_port_event = mail->event<input::touch_port_t>(mail::touch_port);
 
+  overload_t overload { *ref->encoder_p, config };
+
+  // Sessions sharing an encoder don't encode themselves
+  std::optional<cpu_budget_t::lease_t> lease;
+  if(ref->encoder_p->dev_type == AV_HWDEVICE_TYPE_NONE && !(config::video.shared_encode && channel_data)) {
+    auto wanted = sw_threads(*ref->encoder_p, overload.config());
+
+    // The share reserved when the session was admitted
+    if(reservation) {
+      lease = std::move(reservation->lease);
+      lease->update(overload.config(), wanted);
+
+      reservation.reset();
+    }
+    else {
+      lease = cpu_budget.acquire(overload.config(), wanted);
+    }
+  }
+
+  // Set when the last session ended only to be remade with other parameters
+  bool remade = false;
+  std::shared_ptr<platf::img_t> last_img;
+
+  // When the session switched displays, the first frame of the next encoder shows how long the switch took
+  std::optional<std::chrono::steady_clock::time_point> switched;
+
   while(!shutdown_event->peek() && images->running()) {
+    if(switch_display_event->peek()) {
+      auto display_p = *switch_display_event->pop();
+
+      // Get the monitor names now, to get the most up-to-date list of available monitors
+      auto display_names = platf::display_names(map_dev_type(ref->encoder_p->dev_type));
+      if(display_names.empty()) {
+        continue;
+      }
+
+      display_p = std::clamp(display_p, 0, (int)display_names.size() - 1);
+      if(display_names[display_p] == display_name) {
+        continue;
+      }
+
+      switched = std::chrono::steady_clock::now();
+
+      last_img.reset();
+
+      BOOST_LOG(info) << "Switching session from display ["sv << display_name << "] to ["sv << display_names[display_p] << ']';
+
+      // The capture thread of the previous display stops once no session listens to it anymore,
+      // and it has been kept warm long enough to switch back quickly
+      images->stop();
+      images       = std::make_shared<img_event_t::element_type>();
+      display_name = display_names[display_p];
+
+      capture_threads_async.keep_warm(std::move(ref));
+
+      ref = capture_threads_async.ref(display_name);
+      if(!ref) {
+        return;
+      }
+
+      ref->capture_ctx_queue->raise(capture_ctx_t {
+        images, config.framerate, config.width, config.height });
+
+      if(!ref->capture_ctx_queue->running()) {
+        return;
+      }
+
+      remade = false;
+      continue;
+    }
+
     // Wait for the main capture event when the display is being reinitialized
     if(ref->reinit_event.peek()) {
-      std::this_thread::sleep_for(100ms);
+      std::this_thread::sleep_for(10ms);
       continue;
     }
     // Wait for the display to be ready
     std::shared_ptr<platf::display_t> display;
     {
       auto lg = ref->display_wp.lock();
-      if(ref->display_wp->expired()) {
-        continue;
-      }
-
       display = ref->display_wp->lock();
     }
 
+    if(!display) {
+      std::this_thread::sleep_for(10ms);
+      continue;
+    }
+
+    // absolute mouse coordinates require that the dimensions of the screen are known
+    touch_port_event->raise(make_port(display.get(), config));
+
+    if(config::video.shared_encode && channel_data) {
+      shared_encode_t::run(
+        frame_nr,
+        mail, images,
+        config, display_name, display->width, display->height,
+        ref->reinit_event,
+        reservation,
+        channel_data);
+
+      continue;
+    }
+
     auto &encoder = encoders.front();
     auto pix_fmt  = config.dynamicRange == 0 ? map_pix_fmt(encoder.static_pix_fmt) : map_pix_fmt(encoder.dynamic_pix_fmt);
     auto hwdevice = display->make_hwdevice(pix_fmt);
@@ -1338,36 +3353,79 @@ void capture_async(
       return;
     }
 
-    auto dummy_img = display->alloc_img();
-    if(!dummy_img || display->dummy_img(dummy_img.get())) {
-      return;
+    // The capture only raises images that changed, a remade session starts from the last image converted before
+    if(remade && last_img && !images->peek()) {
+      images->raise(std::move(last_img));
+    }
+    else if(!images->peek()) {
+      auto dummy_img = display->alloc_img();
+      if(!dummy_img || display->dummy_img(dummy_img.get())) {
+        return;
+      }
+
+      images->raise(std::move(dummy_img));
     }
 
-    images->raise(std::move(dummy_img));
+    last_img.reset();
 
-    // absolute mouse coordinates require that the dimensions of the screen are known
-    touch_port_event->raise(make_port(display.get(), config));
+    // The images may be scaled down from the display
+    auto [width, height] = display->img_size();
+
+    // A software encoder doesn't need the display, it mustn't hold up the reinitialization of the display
+    if(ref->encoder_p->dev_type == AV_HWDEVICE_TYPE_NONE) {
+      display.reset();
+    }
+
+    auto level   = overload.level();
+    auto threads = lease ? lease->threads() : 0;
 
     encode_run(
       frame_nr,
       mail, images,
-      config, display->width, display->height,
+      overload.config(), width, height,
       std::move(hwdevice),
       ref->reinit_event, *ref->encoder_p,
-      channel_data);
+      overload, lease ? &*lease : nullptr,
+      std::exchange(switched, std::nullopt),
+      last_img,
+      packets, channel_data);
+
+    if(lease && overload.level() != level) {
+      lease->update(overload.config(), sw_threads(*ref->encoder_p, overload.config()));
+    }
+
+    remade = overload.level() != level || (lease && lease->threads() != threads);
+
+    // Some classes of images contain references to the display, only hold on to it for the remade session
+    if(!remade) {
+      last_img.reset();
+    }
+  }
+}
+
+/**
+ * The display configured with output_name, or the first display found if it isn't among them
+ */
+std::string default_display_name(const encoder_t &encoder) {
+  auto display_names = platf::display_names(map_dev_type(encoder.dev_type));
+  if(display_names.empty() || std::find(std::begin(display_names), std::end(display_names), config::video.output_name) != std::end(display_names)) {
+    return config::video.output_name;
   }
+
+  return display_names.front();
 }
 
 void capture(
   safe::mail_t mail,
   config_t config,
+  std::shared_ptr<reservation_t> reservation,
   void *channel_data) {
 
   auto idr_events = mail->event<bool>(mail::idr);
 
   idr_events->raise(true);
   if(encoders.front().flags & PARALLEL_ENCODING) {
-    capture_async(std::move(mail), config, channel_data);
+    capture_async(std::move(mail), config, default_display_name(encoders.front()), mail::man->queue<packet_t>(mail::video_packets), std::move(reservation), channel_data);
   }
   else {
     safe::signal_t join_event;
@@ -1388,6 +3446,27 @@ void capture(
   }
 }
 
+void release_displays() {
+  capture_threads_async.clear();
+}
+
+bool admit(config_t &config, std::shared_ptr<reservation_t> &reservation) {
+  if(encoders.front().dev_type != AV_HWDEVICE_TYPE_NONE) {
+    return true;
+  }
+
+  std::optional<cpu_budget_t::lease_t> lease;
+  if(cpu_budget.admit(config, config::video.core_pixel_rate, config::video.shared_encode, lease) == cpu_budget_t::admit_e::rejected) {
+    return false;
+  }
+
+  if(lease) {
+    reservation = std::make_shared<reservation_t>(reservation_t { std::move(*lease) });
+  }
+
+  return true;
+}
+
 enum validate_flag_e {
   VUI_PARAMS     = 0x01,
   NALU_PREFIX_5b = 0x02,
@@ -1578,6 +3657,157 @@ retry:
   return true;
 }
 
+/**
+ * Identifies what the results of probing the encoders depend on:
+ * the ffmpeg libraries, the GPUs with their drivers, and the settings passed on to the encoders
+ */
+std::string probe_fingerprint() {
+  auto optional = [](const std::optional<int> &value) {
+    return value ? std::to_string(*value) : "-"s;
+  };
+
+  auto &video = config::video;
+
+  std::stringstream ss;
+  ss
+    << avcodec_version() << ';' << avutil_version() << ';'
+    << platf::gpu_fingerprint() << ';'
+    << video.encoder << ';' << video.adapter_name << ';' << video.output_name << ';'
+    << video.hevc_mode << ';' << video.qp << ';' << video.min_threads << ';'
+    << video.sw.preset << ';' << video.sw.tune << ';'
+    << optional(video.nv.preset) << ';' << optional(video.nv.rc) << ';' << video.nv.coder << ';'
+    << optional(video.amd.quality) << ';' << optional(video.amd.rc_h264) << ';' << optional(video.amd.rc_hevc) << ';' << video.amd.coder << ';'
+    << config::sunshine.flags[config::flag::FORCE_VIDEO_HEADER_REPLACE];
+
+  // Which codecs are probed depends on the flags of the encoders
+  for(auto &encoder : encoders) {
+    ss << ';' << encoder.name << ':' << encoder.flags;
+  }
+
+  return ss.str();
+}
+
+/**
+ * The results of validate_encoder() are saved in config::nvhttp.file_state,
+ * the next start reuses them for as long as the fingerprint stays the same.
+ */
+class probe_cache_t {
+public:
+  probe_cache_t() : fingerprint { probe_fingerprint() } {
+    auto &file = config::nvhttp.file_state;
+
+    if(
+      config::sunshine.flags[config::flag::FRESH_STATE] ||
+      config::sunshine.flags[config::flag::REPROBE_ENCODERS] ||
+      !fs::exists(file)) {
+      return;
+    }
+
+    pt::ptree root;
+    try {
+      pt::read_json(file, root);
+    }
+    catch(std::exception &e) {
+      BOOST_LOG(warning) << "Couldn't read "sv << file << ": "sv << e.what();
+      return;
+    }
+
+    auto node = root.get_child_optional("encoders"s);
+    if(!node) {
+      return;
+    }
+
+    if(node->get("fingerprint"s, ""s) != fingerprint) {
+      BOOST_LOG(info) << "The GPUs, their drivers or the encoder settings changed since the encoders were probed"sv;
+      return;
+    }
+
+    results = std::move(*node);
+  }
+
+  /**
+   * Returns the result saved for encoder, otherwise probes it with validate_encoder()
+   */
+  bool validate(encoder_t &encoder) {
+    if(auto passed = load(encoder)) {
+      BOOST_LOG(info) << "Encoder ["sv << encoder.name << (*passed ? "] passed"sv : "] failed"sv) << " when it was last probed"sv;
+      return *passed;
+    }
+
+    auto passed = validate_encoder(encoder);
+
+    std::string name { encoder.name };
+    results.put(name + ".passed", passed);
+    results.put(name + ".h264", encoder.h264.capabilities.to_string());
+    results.put(name + ".hevc", encoder.hevc.capabilities.to_string());
+
+    dirty = true;
+
+    return passed;
+  }
+
+  /**
+   * Save the results of the encoders probed during this start
+   */
+  void save() {
+    if(!dirty || config::sunshine.flags[config::flag::FRESH_STATE]) {
+      return;
+    }
+
+    auto &file = config::nvhttp.file_state;
+
+    pt::ptree root;
+    try {
+      if(fs::exists(file)) {
+        pt::read_json(file, root);
+      }
+
+      results.put("fingerprint"s, fingerprint);
+      root.put_child("encoders"s, results);
+
+      // http::init may read the file at the same time, it must never see it half written
+      auto tmp = file + ".tmp"s;
+      pt::write_json(tmp, root);
+      fs::rename(tmp, file);
+    }
+    catch(std::exception &e) {
+      BOOST_LOG(warning) << "Couldn't save the probed encoders to "sv << file << ": "sv << e.what();
+    }
+  }
+
+private:
+  /**
+   * Restore the capabilities of encoder, if they're saved.
+   * Returns whether encoder passed, std::nullopt if it must be probed
+   */
+  std::optional<bool> load(encoder_t &encoder) {
+    auto node = results.get_child_optional(std::string { encoder.name });
+    if(!node) {
+      return std::nullopt;
+    }
+
+    try {
+      if(!node->get<bool>("passed"s)) {
+        return false;
+      }
+
+      encoder.h264.capabilities = decltype(encoder.h264.capabilities) { node->get<std::string>("h264"s) };
+      encoder.hevc.capabilities = decltype(encoder.hevc.capabilities) { node->get<std::string>("hevc"s) };
+    }
+    catch(std::exception &e) {
+      BOOST_LOG(warning) << "Couldn't restore the probed capabilities of encoder ["sv << encoder.name << "]: "sv << e.what();
+      return std::nullopt;
+    }
+
+    return true;
+  }
+
+  std::string fingerprint;
+
+  pt::ptree results;
+  bool dirty {};
+};
+
 int init() {
   BOOST_LOG(info) << "//////////////////////////////////////////////////////////////////"sv;
   BOOST_LOG(info) << "//                                                              //"sv;
@@ -1586,10 +3816,20 @@ int init() {
   BOOST_LOG(info) << "//                                                              //"sv;
   BOOST_LOG(info) << "//////////////////////////////////////////////////////////////////"sv;
 
+  tuning.load();
+
+  if(!validate_converter()) {
+    BOOST_LOG(warning) << "Converting images with swscale only"sv;
+
+    use_converter = false;
+  }
+
+  probe_cache_t probe_cache;
+
   KITTY_WHILE_LOOP(auto pos = std::begin(encoders), pos != std::end(encoders), {
     if(
       (!config::video.encoder.empty() && pos->name != config::video.encoder) ||
-      !validate_encoder(*pos) ||
+      !probe_cache.validate(*pos) ||
       (config::video.hevc_mode == 3 && !pos->hevc[encoder_t::DYNAMIC_RANGE])) {
       pos = encoders.erase(pos);
 
@@ -1599,6 +3839,8 @@ int init() {
     break;
   })
 
+  probe_cache.save();
+
   BOOST_LOG(info);
   BOOST_LOG(info) << "//////////////////////////////////////////////////////////////"sv;
   BOOST_LOG(info) << "//                                                          //"sv;
@@ -1620,6 +3862,15 @@ int init() {
 
   auto &encoder = encoders.front();
 
+  // x265 only keeps up on a fast enough CPU
+  if(
+    encoder.dev_type == AV_HWDEVICE_TYPE_NONE && config::video.hevc_mode == 0 &&
+    encoder.hevc[encoder_t::PASSED] && !tuning.keeps_up(1)) {
+    BOOST_LOG(info) << "Software HEVC is only offered once sunshine --tune has measured that it keeps up"sv;
+
+    encoder.hevc[encoder_t::PASSED] = false;
+  }
+
   BOOST_LOG(debug) << "------  h264 ------"sv;
   for(int x = 0; x < encoder_t::MAX_FLAGS; ++x) {
     auto flag = (encoder_t::flag_e)x;
@@ -1645,6 +3896,233 @@ int init() {
     config::video.hevc_mode = encoder.hevc[encoder_t::PASSED] ? (encoder.hevc[encoder_t::DYNAMIC_RANGE] ? 3 : 2) : 1;
   }
 
+  if(config::video.prewarm) {
+    session_cache.prewarm(encoder);
+  }
+
+  return 0;
+}
+
+/**
+ * Fill frame with a noisy texture that scrolls across a gradient,
+ * so the encoder has detail and motion to work with
+ */
+void fill_synthetic(AVFrame *frame, int frame_nr, const std::vector<std::uint8_t> &noise) {
+  auto mask = noise.size() - 1;
+
+  for(int y = 0; y < frame->height; ++y) {
+    auto row = frame->data[0] + y * frame->linesize[0];
+    for(int x = 0; x < frame->width; ++x) {
+      auto texture = noise[(y * 257 + x + frame_nr * 8) & mask];
+
+      row[x] = (std::uint8_t)(32 + ((x + y + frame_nr * 2) & 0xFF) / 2 + texture / 4);
+    }
+  }
+
+  for(int plane = 1; plane < 3; ++plane) {
+    for(int y = 0; y < frame->height / 2; ++y) {
+      auto row = frame->data[plane] + y * frame->linesize[plane];
+      for(int x = 0; x < frame->width / 2; ++x) {
+        row[x] = (std::uint8_t)(64 + ((plane == 1 ? x : y) + frame_nr) % 128);
+      }
+    }
+  }
+}
+
+/**
+ * Encode synthetic frames with preset and threads, returns the encode time of each frame.
+ * Gives up once the average encode time exceeds give_up, returning no times at all
+ */
+std::vector<std::chrono::nanoseconds> benchmark(
+  const encoder_t &encoder, const config_t &config,
+  std::string_view preset, int threads,
+  std::chrono::nanoseconds give_up) {
+
+  constexpr auto warmup = 10;
+  constexpr auto frames = 60;
+
+  std::vector<encoder_t::option_t> options {
+    { "preset"s, std::string { preset } },
+    { "threads"s, threads },
+    { "slices"s, threads },
+  };
+
+  auto session = make_session(encoder, config, config.width, config.height, std::make_shared<platf::hwdevice_t>(), options);
+  if(!session) {
+    return {};
+  }
+
+  std::vector<std::uint8_t> noise(1 << 16);
+  std::minstd_rand rand;
+  std::generate(std::begin(noise), std::end(noise), [&rand]() { return (std::uint8_t)rand(); });
+
+  auto mail    = mail::make();
+  auto packets = mail->queue<packet_t>(mail::video_packets);
+
+  auto frame = session->device->frame;
+
+  std::vector<std::chrono::nanoseconds> times;
+  std::chrono::nanoseconds total {};
+  for(int frame_nr = 1; frame_nr <= warmup + frames; ++frame_nr) {
+    av_frame_make_writable(frame);
+    fill_synthetic(frame, frame_nr, noise);
+
+    auto begin = std::chrono::steady_clock::now();
+    if(encode(frame_nr, *session, frame, packets, nullptr)) {
+      return {};
+    }
+    auto time = std::chrono::steady_clock::now() - begin;
+
+    while(packets->peek()) {
+      packets->pop();
+    }
+
+    if(frame_nr <= warmup) {
+      continue;
+    }
+
+    times.emplace_back(time);
+    total += time;
+
+    if(times.size() == (std::size_t)warmup && total / times.size() > give_up) {
+      return {};
+    }
+  }
+
+  return times;
+}
+
+int tune(const std::vector<std::string> &resolutions) {
+  auto encoder = std::find_if(std::begin(encoders), std::end(encoders), [](const encoder_t &encoder) {
+    return encoder.dev_type == AV_HWDEVICE_TYPE_NONE;
+  });
+
+  probe_cache_t probe_cache;
+  if(!probe_cache.validate(*encoder)) {
+    BOOST_LOG(error) << "The software encoder isn't available"sv;
+    return -1;
+  }
+  probe_cache.save();
+
+  std::vector<std::pair<int, int>> sizes;
+  for(auto &resolution : resolutions.empty() ? config::nvhttp.resolutions : resolutions) {
+    if(auto size = parse_resolution(resolution)) {
+      sizes.emplace_back(*size);
+    }
+    else {
+      BOOST_LOG(warning) << "Skipping resolution ["sv << resolution << "], expected WIDTHxHEIGHT"sv;
+    }
+  }
+
+  auto framerates = config::nvhttp.fps;
+  std::sort(std::begin(framerates), std::end(framerates));
+
+  if(sizes.empty() || framerates.empty()) {
+    BOOST_LOG(error) << "There are no resolutions or framerates to tune for"sv;
+    return -1;
+  }
+
+  // Slowest first, the slowest preset that keeps up gives the best quality
+  static const std::vector<std::string_view> presets {
+    "medium"sv, "fast"sv, "faster"sv, "veryfast"sv, "superfast"sv, "ultrafast"sv
+  };
+
+  // Fewest first, the encoder threads beyond those needed are better left to other sessions
+  auto cores = std::max(1, (int)std::thread::hardware_concurrency());
+  std::vector<int> thread_counts;
+  for(int threads = 1; threads < cores; threads *= 2) {
+    thread_counts.emplace_back(threads);
+  }
+  thread_counts.emplace_back(cores);
+
+  // Capturing and converting the image take part of the frame interval as well
+  auto budget = [](int framerate) {
+    return std::chrono::nanoseconds { 1s } * 8 / 10 / framerate;
+  };
+
+  std::vector<tuning_t::entry_t> entries;
+  for(int videoFormat = 0; videoFormat < 2; ++videoFormat) {
+    auto &video_format = videoFormat == 0 ? encoder->h264 : encoder->hevc;
+    if(!video_format[encoder_t::PASSED]) {
+      continue;
+    }
+
+    for(auto [width, height] : sizes) {
+      config_t config { width, height, framerates.back(), 20000, 1, 1, 0, videoFormat, 0 };
+
+      // The choice for each framerate, and the fastest combination in case nothing keeps up
+      std::vector<std::optional<tuning_t::entry_t>> chosen(framerates.size());
+      std::optional<tuning_t::entry_t> fastest;
+
+      for(auto preset : presets) {
+        for(auto threads : video_format[encoder_t::SLICE] ? thread_counts : std::vector<int> { 1 }) {
+          auto pending = std::find(std::begin(chosen), std::end(chosen), std::nullopt);
+          if(pending == std::end(chosen)) {
+            break;
+          }
+
+          auto loosest = budget(framerates[pending - std::begin(chosen)]);
+          auto times   = benchmark(*encoder, config, preset, threads, loosest * 2);
+          if(times.empty()) {
+            BOOST_LOG(info) << video_format.name << ' ' << width << 'x' << height << ": preset "sv << preset << ", "sv << threads << " threads is too slow"sv;
+            continue;
+          }
+
+          std::sort(std::begin(times), std::end(times));
+          auto latency = std::chrono::duration<double, std::milli>(times[times.size() * 95 / 100]).count();
+
+          BOOST_LOG(info)
+            << video_format.name << ' ' << width << 'x' << height << ": preset "sv << preset << ", "sv << threads
+            << " threads encodes in "sv << latency << "ms"sv;
+
+          tuning_t::entry_t entry { videoFormat, width, height, 0, std::string { preset }, threads, latency, true };
+          if(!fastest || latency < fastest->latency) {
+            fastest = entry;
+          }
+
+          for(std::size_t x = 0; x < framerates.size(); ++x) {
+            if(!chosen[x] && latency <= std::chrono::duration<double, std::milli>(budget(framerates[x])).count()) {
+              chosen[x]            = entry;
+              chosen[x]->framerate = framerates[x];
+            }
+          }
+
+          // More threads only pay off for the framerates that don't keep up yet
+          if(chosen.back()) {
+            break;
+          }
+        }
+      }
+
+      for(std::size_t x = 0; x < framerates.size(); ++x) {
+        auto &entry = chosen[x];
+        if(!entry) {
+          if(!fastest) {
+            continue;
+          }
+
+          BOOST_LOG(warning) << video_format.name << ' ' << width << 'x' << height << 'x' << framerates[x] << " doesn't keep up, using the fastest settings"sv;
+
+          entry            = fastest;
+          entry->framerate = framerates[x];
+          entry->keeps_up  = false;
+        }
+
+        BOOST_LOG(info)
+          << video_format.name << ' ' << width << 'x' << height << 'x' << entry->framerate
+          << ": preset "sv << entry->preset << ", "sv << entry->threads << " threads"sv;
+
+        entries.emplace_back(std::move(*entry));
+      }
+    }
+  }
+
+  if(tuning.save(entries)) {
+    return -1;
+  }
+
+  BOOST_LOG(info) << "Saved the tuning to "sv << config::video.file_tuning;
+
   return 0;
 }
 
@@ -1740,18 +4218,19 @@ util::Either<buffer_t, int> dxgi_make_hwdevice_ctx(platf::hwdevice_t *hwdevice_c
 }
 #endif
 
-int start_capture_async(capture_thread_async_ctx_t &capture_thread_ctx) {
+int start_capture_async(capture_thread_async_ctx_t &capture_thread_ctx, const std::string &display_name) {
   capture_thread_ctx.encoder_p = &encoders.front();
   capture_thread_ctx.reinit_event.reset();
 
-  capture_thread_ctx.capture_ctx_queue = std::make_shared<safe::queue_t<capture_ctx_t>>(30);
+  capture_thread_ctx.capture_ctx_queue = std::make_shared<safe::queue_t<capture_ctx_t>>(30, safe::overflow_e::block, "video::capture_ctx_queue");
 
   capture_thread_ctx.capture_thread = std::thread {
     captureThread,
     capture_thread_ctx.capture_ctx_queue,
     std::ref(capture_thread_ctx.display_wp),
     std::ref(capture_thread_ctx.reinit_event),
-    std::ref(*capture_thread_ctx.encoder_p)
+    std::ref(*capture_thread_ctx.encoder_p),
+    display_name
   };
 
   return 0;
@@ -1827,5 +4306,7 @@ color_t colors[] {
   make_color_matrix(0.299f, 0.114f, 0.5f, 0.5f, 0.0f, 0.5f, { 0.0f, 255.0f }, { 0.0f, 255.0f }),           // BT601 JPEG
   make_color_matrix(0.2126f, 0.0722f, 0.436f, 0.615f, 0.0625, 0.5f, { 16.0f, 235.0f }, { 16.0f, 240.0f }), // BT701 MPEG
   make_color_matrix(0.2126f, 0.0722f, 0.5f, 0.5f, 0.0f, 0.5f, { 0.0f, 255.0f }, { 0.0f, 255.0f }),         // BT701 JPEG
+  make_color_matrix(0.2627f, 0.0593f, 0.436f, 0.615f, 0.0625, 0.5f, { 16.0f, 235.0f }, { 16.0f, 240.0f }), // BT2020 MPEG
+  make_color_matrix(0.2627f, 0.0593f, 0.5f, 0.5f, 0.0f, 0.5f, { 0.0f, 255.0f }, { 0.0f, 255.0f }),         // BT2020 JPEG
 };
 } // namespace video
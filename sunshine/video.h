@@ -53,6 +53,9 @@ struct packet_raw_t : public AVPacket {
 
   std::vector<replace_t> *replacements;
 
+  // Keeps replacements alive when the packet may outlive the session that encoded it
+  std::shared_ptr<const void> replacements_owner;
+
   void *channel_data;
 };
 
@@ -82,14 +85,42 @@ struct __attribute__((__aligned__(16))) color_t {
   float2 range_uv;
 };
 
-extern color_t colors[4];
+extern color_t colors[6];
+
+/**
+ * The share of the host set aside for an admitted session, it's given back when the reservation is destroyed
+ */
+struct reservation_t;
 
 void capture(
   safe::mail_t mail,
   config_t config,
+  std::shared_ptr<reservation_t> reservation,
   void *channel_data);
 
+/**
+ * Decide whether the host can encode a new session next to the running ones.
+ * If the session only fits at a lower framerate, config.framerate is lowered.
+ * An admitted session may get a reservation, it's to be passed on to capture()
+ * Returns false if the session is rejected
+ */
+bool admit(config_t &config, std::shared_ptr<reservation_t> &reservation);
+
+/**
+ * Stop capturing the displays kept warm after sessions switched away from them.
+ * Called before Sunshine exits, the capture threads reference the encoders
+ */
+void release_displays();
+
 int init();
+
+/**
+ * Measure the preset and encoder threads with which the software encoder keeps up
+ * with each of the resolutions and the advertised framerates, and save them to config::video.file_tuning.
+ *
+ * resolutions --> WIDTHxHEIGHT, the advertised resolutions if empty
+ */
+int tune(const std::vector<std::string> &resolutions);
 } // namespace video
 
 #endif //SUNSHINE_VIDEO_H